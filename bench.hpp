@@ -0,0 +1,255 @@
+#pragma once
+
+#include <algorithm>
+
+#include "rc-bridge.hpp"
+
+namespace RCBridge {
+
+// 延迟样本，超过容量后用蓄水池抽样保留等概率的子集，以便在内存有限的ESP8266上也能估计分位数
+template <size_t CAPACITY>
+class LatencySamples {
+
+protected:
+    uint32_t samples[CAPACITY];
+    // 蓄水池抽样用的线性同余发生器
+    uint32_t lcg;
+
+public:
+    // 样本总数、最大值、总和
+    uint32_t count;
+    uint32_t max;
+    uint64_t sum;
+
+public:
+    LatencySamples() {
+        clear();
+    }
+
+    void clear() {
+        lcg = 1;
+        count = 0;
+        max = 0;
+        sum = 0;
+    }
+
+    void add(uint32_t value) {
+        if(count < CAPACITY) {
+            samples[count] = value;
+        }
+        else {
+            lcg = lcg * 1664525 + 1013904223;
+            uint32_t i = (uint32_t)(((uint64_t)lcg * (count + 1)) >> 32);
+            if(i < CAPACITY) {
+                samples[i] = value;
+            }
+        }
+        count++;
+        sum += value;
+        if(value > max) {
+            max = value;
+        }
+    }
+
+    // 第permille‰分位数，会对样本排序
+    uint32_t percentile(uint32_t permille) {
+        size_t n = count < CAPACITY ? count : CAPACITY;
+        if(n == 0) {
+            return 0;
+        }
+        std::sort(samples, samples + n);
+        size_t i = (size_t)(((uint64_t)n * permille + 999) / 1000);
+        return samples[i == 0 ? 0 : i - 1];
+    }
+
+    // 转化为<p50 = x, p99 = x, p99.9 = x, max = x>的人类可读形式
+    String toString() {
+        char buffer[96];
+        snprintf(buffer, sizeof(buffer), "p50 = %u, p99 = %u, p99.9 = %u, max = %u",
+            percentile(500), percentile(990), percentile(999), max);
+        return String(buffer);
+    }
+
+};
+
+// 基准测试的发送端：以给定的长度发送数据帧，帧首是递增的32位帧号（小端，按长度截断），
+// 并测量每帧从交给无线到onSent()的完成延迟
+class BenchSender: public BasicSender {
+
+public:
+    // 记录发送时刻的帧数，接收端按帧号查表计算端到端延迟（仅当两端在同一进程中时有效，
+    // 所以在ESP8266上不占内存）
+    static constexpr size_t HISTORY = RCB_HAL_POSIX ? 4096 : 1;
+
+protected:
+    // 下一帧的帧号
+    uint32_t bench_seq;
+    // 最近HISTORY帧的发送时刻（us）
+    uint32_t send_times[HISTORY];
+
+public:
+    // 统计：调用send()的次数、成功（发出或入队）的次数、对端确认的次数、成功的字节数
+    uint32_t nsend;
+    uint32_t nsend_ok;
+    uint32_t nacked;
+    uint64_t nbytes;
+    // 交给无线到onSent()的延迟（us）
+    LatencySamples<RCB_HAL_POSIX ? (1 << 16) : 256> completion;
+    // 统计：收到的遥测帧数
+    uint32_t ntelemetry;
+
+public:
+    BenchSender() {
+        clearBench();
+    }
+
+    void clearBench() {
+        bench_seq = 0;
+        nsend = 0;
+        nsend_ok = 0;
+        nacked = 0;
+        nbytes = 0;
+        completion.clear();
+        ntelemetry = 0;
+    }
+
+    bool sendBench(uint8_t len) {
+        send_times[bench_seq % HISTORY] = HAL::micros();
+        uint32_t seq = bench_seq++;
+        nsend++;
+        Frame frame = acquire(len);
+        if(!frame) {
+            return false;
+        }
+        uint8_t* data = frame.data();
+        for(uint8_t i = 0; i < len; i++) {
+            data[i] = i < 4 ? (uint8_t)(seq >> (i * 8)) : i;
+        }
+        commit(frame);
+        nsend_ok++;
+        nbytes += len;
+        return true;
+    }
+
+    uint32_t sendTime(uint32_t seq) const {
+        return send_times[seq % HISTORY];
+    }
+
+    uint32_t nextSeq() const {
+        return bench_seq;
+    }
+
+    // 转化为人类可读的形式
+    String benchString() {
+        char buffer[128];
+        snprintf(buffer, sizeof(buffer), "send = %u, ok = %u, acked = %u, coalesced = %u, bytes = %llu\n",
+            nsend, nsend_ok, nacked, ncoalesce, (unsigned long long)nbytes);
+        String s(buffer);
+        s.concat("completion (us): ");
+        s.concat(completion.toString());
+        s.concat("\n");
+        return s;
+    }
+
+protected:
+    virtual void onSent(uint8_t* addr, uint8_t status) override {
+        if(matched && tx_busy && memcmp(addr, peer.addr, 6) == 0) {
+            completion.add(HAL::micros() - tx_time);
+            if(status == 0) {
+                nacked++;
+            }
+        }
+        BasicSender::onSent(addr, status);
+    }
+
+    virtual void onTelemetry(uint8_t /*len*/, void* /*data*/) override {
+        ntelemetry++;
+    }
+
+};
+
+// 基准测试的接收端：从帧首还原帧号，统计收到的帧数和字节数；
+// 给出同一进程中的发送端时测量端到端延迟，否则测量接收回调的耗时
+class BenchReceiver: public BasicReceiver {
+
+protected:
+    const BenchSender* local_sender;
+    // 上一帧的帧号
+    uint32_t last_seq;
+
+public:
+    // 统计：收到的帧数和字节数
+    uint32_t nreceive;
+    uint64_t nbytes;
+    // send()到onData()的端到端延迟（us）
+    LatencySamples<RCB_HAL_POSIX ? (1 << 16) : 256> latency;
+    // onReceived()回调的耗时（us），只在硬件上测量：主机上的虚拟时钟在回调中不走，总是0
+    LatencySamples<256> callback;
+
+public:
+    BenchReceiver() {
+        clearBench();
+    }
+
+    void clearBench(const BenchSender* local_sender = nullptr) {
+        this->local_sender = local_sender;
+        last_seq = (uint32_t)-1;
+        nreceive = 0;
+        nbytes = 0;
+        latency.clear();
+        callback.clear();
+    }
+
+    // 转化为人类可读的形式
+    String benchString() {
+        char buffer[64];
+        snprintf(buffer, sizeof(buffer), "receive = %u, bytes = %llu\n", nreceive, (unsigned long long)nbytes);
+        String s(buffer);
+        if(local_sender) {
+            s.concat("end-to-end (us): ");
+            s.concat(latency.toString());
+            s.concat("\n");
+        }
+#if RCB_HAL_ESP8266
+        s.concat("callback (us): ");
+        s.concat(callback.toString());
+        s.concat("\n");
+#else
+        s.concat("callback (us): not measured on host\n");
+#endif
+        return s;
+    }
+
+protected:
+    virtual void onReceived(uint8_t* addr, uint8_t* data, uint8_t len) override {
+        uint32_t cycles = HAL::cycleCount();
+        BasicReceiver::onReceived(addr, data, len);
+        if(RCB_HAL_ESP8266 && matched) {
+            callback.add((HAL::cycleCount() - cycles) / HAL::cpuFreqMHz());
+        }
+    }
+
+    virtual void onData(uint8_t len, void* data) override {
+        uint32_t now = HAL::micros();
+        nreceive++;
+        nbytes += len;
+        if(len == 0) {
+            return;
+        }
+        // 帧号被截断为len字节，而esp-now不会乱序，所以取比上一帧大的最小的那个
+        uint8_t nbyte = len < 4 ? len : 4;
+        uint32_t low = 0;
+        for(uint8_t i = 0; i < nbyte; i++) {
+            low |= (uint32_t)((uint8_t*)data)[i] << (i * 8);
+        }
+        uint32_t mask = nbyte == 4 ? 0xffffffff : (1u << (nbyte * 8)) - 1;
+        uint32_t seq = last_seq + 1 + ((low - (last_seq + 1)) & mask);
+        last_seq = seq;
+        if(local_sender && local_sender->nextSeq() - seq <= BenchSender::HISTORY) {
+            latency.add(now - local_sender->sendTime(seq));
+        }
+    }
+
+};
+
+}
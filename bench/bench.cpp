@@ -0,0 +1,250 @@
+// 主机上的端到端基准测试：BasicSender::send() -> 模拟的esp-now介质 -> BasicReceiver::onData()，
+// 在虚拟时钟下对各帧率和载荷长度的组合测量延迟分位数、吞吐量和丢帧率。
+// 编译运行：
+//     g++ -std=c++17 -O2 -I.. bench.cpp -o bench && ./bench
+// 参数：
+//     -t <秒>      每个组合仿真的时长，默认10
+//     -l <丢帧率>  独立丢帧率，默认0
+//     -c           合并待发送的帧（配置项tx.coalesce），否则发送队列满时丢弃新帧
+//     -f           按跳频序列定时跳频（配置项fhss）
+//     -j <信道>    该信道完全不通，模拟被干扰
+//     -b           改用突发丢帧（好状态丢帧率为-l，平均每1000帧出现一次长20帧、丢帧率90%的突发）
+//     -p <us>      loop()的调用间隔，默认50
+//     -s <种子>    随机数种子，默认1
+//     -r <帧率>    只测该帧率（Hz）
+//     -n <字节>    只测该载荷长度
+//     -P           不预先写入配对信息，而是现场配对，并报告配对耗时
+//     -R           防重放（配置项replay），并报告被拒绝的帧数
+//     -D <us>      冗余模式，每帧隔该时间后重发一份（配置项tx.repeat），并报告重发和救回的帧数
+//     -F <K>       前向纠错，每K帧一个校验帧（配置项fec），并报告校验帧数和还原的帧数
+//     -T <帧率>    接收端以该帧率（Hz）回传16字节的遥测（配置项telemetry.rate同为该值），并报告回传的帧数
+
+#include <getopt.h>
+#include <vector>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "bench.hpp"
+
+using namespace RCBridge;
+
+// 暴露出protected成员，以便在测试目录中预先写好配置和配对信息
+template <typename T>
+class Node: public T {
+
+public:
+    // 在root/dir下写入配置文件
+    void setup(const char* root, const char* dir, const char* json) {
+        char path[300];
+        snprintf(path, sizeof(path), "%s/%s", root, dir);
+        mkdir(path, 0755);
+        this->fs.setRoot(root);
+        String fpath(dir);
+        fpath.concat("/");
+        fpath.concat(T::FNAME_JSON);
+        this->fs.write(fpath.c_str(), json, strlen(json));
+    }
+
+    const uint8_t* address() const {
+        return this->radio.address();
+    }
+
+    const FecDecoder& fecDecoder() const {
+        return this->fec_decoder;
+    }
+
+    // 写入配对信息，使begin()跳过配对
+    void pair(const uint8_t* addr) {
+        memcpy(this->peer.addr, addr, 6);
+        memset(this->peer.key, 0x5a, sizeof(this->peer.key));
+        this->fs.write(T::FPATH_PEER, &this->peer, sizeof(this->peer));
+    }
+
+};
+
+struct Options {
+    uint32_t seconds = 10;
+    double loss = 0.0;
+    bool coalesce = false;
+    bool fhss = false;
+    uint8_t jammed = 0;
+    bool burst = false;
+    uint32_t loop_us = 50;
+    uint64_t seed = 1;
+    uint32_t rate = 0;
+    uint32_t size = 0;
+    bool pair = false;
+    bool replay = false;
+    uint32_t telemetry = 0;
+    uint32_t repeat = 0;
+    uint32_t fec = 0;
+};
+
+static void removeDir(const char* root) {
+    char command[320];
+    snprintf(command, sizeof(command), "rm -rf %s", root);
+    if(system(command) != 0) {
+        fprintf(stderr, "failed to remove <%s>\n", root);
+    }
+}
+
+static void runOne(const Options& options, uint32_t rate, uint8_t size) {
+    char root[] = "/tmp/rc-bridge-bench-XXXXXX";
+    if(mkdtemp(root) == nullptr) {
+        perror("mkdtemp");
+        exit(1);
+    }
+    HAL::Clock::useVirtual();
+    HAL::Medium& medium = HAL::Medium::instance();
+    medium.reset();
+    medium.seed(options.seed);
+    medium.setTiming(HAL::LinkTiming());
+    if(options.burst) {
+        medium.setChannelModel(0, HAL::ChannelModel::burst(options.loss, 0.9, 1000, 20));
+    }
+    else {
+        medium.setChannelModel(0, HAL::ChannelModel::independent(options.loss));
+    }
+    if(options.jammed) {
+        medium.setChannelModel(options.jammed, HAL::ChannelModel::independent(1.0));
+    }
+    char sender_root[64], receiver_root[64];
+    snprintf(sender_root, sizeof(sender_root), "%s/s", root);
+    snprintf(receiver_root, sizeof(receiver_root), "%s/r", root);
+    mkdir(sender_root, 0755);
+    mkdir(receiver_root, 0755);
+    Node<BenchSender> sender;
+    Node<BenchReceiver> receiver;
+    char sender_json[160], receiver_json[96];
+    snprintf(sender_json, sizeof(sender_json),
+        "{\"tx.coalesce\": %d, \"fhss\": %d, \"replay\": %d, \"tx.repeat\": %u, \"fec\": %u}",
+        options.coalesce, options.fhss, options.replay, options.repeat, options.fec);
+    snprintf(receiver_json, sizeof(receiver_json), "{\"fhss\": %d, \"replay\": %d, \"telemetry.rate\": %u}",
+        options.fhss, options.replay, options.telemetry);
+    sender.setup(sender_root, "sender", sender_json);
+    receiver.setup(receiver_root, "receiver", receiver_json);
+    if(!options.pair) {
+        sender.pair(receiver.address());
+        receiver.pair(sender.address());
+    }
+    if(!receiver.begin() || !sender.begin()) {
+        fprintf(stderr, "failed to start nodes in <%s>\n", root);
+        exit(1);
+    }
+    // 现场配对，至多等待10秒
+    uint64_t pair_end = HAL::Clock::now() + 10000000;
+    while(!(sender.isPaired() && receiver.isPaired()) && HAL::Clock::now() < pair_end) {
+        medium.run(options.loop_us);
+        sender.loop();
+        receiver.loop();
+    }
+    if(!sender.isPaired() || !receiver.isPaired()) {
+        printf("%4uHz %3uB: failed to pair in 10 s, %u beacons\n", rate, size, sender.nbeacon);
+        removeDir(root);
+        return;
+    }
+    sender.clearBench();
+    receiver.clearBench(&sender);
+    uint64_t period = 1000000 / rate;
+    uint64_t start = HAL::Clock::now();
+    uint64_t end = start + (uint64_t)options.seconds * 1000000;
+    uint64_t next_send = start;
+    uint64_t telemetry_period = options.telemetry ? 1000000 / options.telemetry : 0;
+    uint64_t next_telemetry = start;
+    uint32_t ntelemetry = 0;
+    while(HAL::Clock::now() < end) {
+        if(HAL::Clock::now() >= next_send) {
+            sender.sendBench(size);
+            next_send += period;
+        }
+        if(telemetry_period && HAL::Clock::now() >= next_telemetry) {
+            uint8_t telemetry[16] = {0};
+            ntelemetry += receiver.sendTelemetry(sizeof(telemetry), telemetry);
+            next_telemetry += telemetry_period;
+        }
+        uint64_t until = HAL::Clock::now() + options.loop_us;
+        medium.runUntil(until < next_send ? until : next_send);
+        sender.loop();
+        receiver.loop();
+    }
+    // 等待在途的帧
+    for(int i = 0; i < 100; i++) {
+        medium.run(options.loop_us);
+        sender.loop();
+        receiver.loop();
+    }
+    double drop = sender.nsend == 0 ? 0.0 : 1.0 - (double)receiver.nreceive / sender.nsend;
+    double throughput = (double)receiver.nbytes / options.seconds / 1000;
+    printf("%4uHz %3uB: sent %u, received %u, coalesced %u, drop %.2f%%, %.2f kB/s\n", rate, size, sender.nsend,
+        receiver.nreceive, sender.ncoalesce, drop * 100, throughput);
+    printf("    end-to-end (us): %s\n", receiver.latency.toString().c_str());
+    printf("    completion (us): %s\n", sender.completion.toString().c_str());
+    printf("    recovered: sender %u (max %ums), receiver %u (max %ums), fhss sync lost %u\n", sender.nrecover,
+        sender.max_recover_ms, receiver.nrecover, receiver.max_recover_ms, receiver.nsync_lost);
+    if(options.pair) {
+        printf("    paired in %ums, %u beacons\n", sender.pair_ms, sender.nbeacon);
+    }
+    if(options.replay) {
+        printf("    replay rejected: sender %u, receiver %u\n", sender.nreplay, receiver.nreplay);
+    }
+    if(options.repeat) {
+        printf("    redundancy: repeated %u, skipped %u, rescued %u\n", sender.nrepeat, sender.nrepeat_skip,
+            receiver.nrescued);
+    }
+    if(options.fec) {
+        printf("    fec: parity %u, skipped %u, recovered %u, unrecoverable %u\n", sender.nparity, sender.nparity_skip,
+            receiver.fecDecoder().nrecovered, receiver.fecDecoder().nunrecoverable);
+    }
+    if(options.telemetry) {
+        printf("    telemetry: queued %u, sent %u (failed %u), received %u\n", ntelemetry, receiver.ntelemetry,
+            receiver.ntelemetry_fail, sender.ntelemetry);
+    }
+    removeDir(root);
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    int opt;
+    while((opt = getopt(argc, argv, "t:l:cfj:bp:s:r:n:PRD:F:T:")) != -1) {
+        switch(opt) {
+            case 't': options.seconds = atoi(optarg); break;
+            case 'l': options.loss = atof(optarg); break;
+            case 'c': options.coalesce = true; break;
+            case 'f': options.fhss = true; break;
+            case 'j': options.jammed = atoi(optarg); break;
+            case 'b': options.burst = true; break;
+            case 'p': options.loop_us = atoi(optarg); break;
+            case 's': options.seed = strtoull(optarg, nullptr, 0); break;
+            case 'r': options.rate = atoi(optarg); break;
+            case 'n': options.size = atoi(optarg); break;
+            case 'P': options.pair = true; break;
+            case 'R': options.replay = true; break;
+            case 'D': options.repeat = atoi(optarg); break;
+            case 'F': options.fec = atoi(optarg); break;
+            case 'T': options.telemetry = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-t seconds] [-l loss] [-c] [-f] [-j channel] [-b] [-p loop_us] [-s seed] [-r rate] [-n size] [-P] [-R] [-D us] [-F k] [-T rate]\n", argv[0]);
+                return 1;
+        }
+    }
+    // 协议代码的调试输出（如发送失败）在高帧率下会刷屏，关掉
+    HAL::print_stream = nullptr;
+    std::vector<uint32_t> rates = {50, 100, 250, 500, 1000};
+    std::vector<uint8_t> sizes = {1, 23, 64, 128, 249};
+    if(options.rate) {
+        rates = {options.rate};
+    }
+    if(options.size) {
+        sizes = {(uint8_t)options.size};
+    }
+    printf("%s, %s, %s loss, jammed channel %u, %u s per case, loop() every %u us, seed %llu\n",
+        options.coalesce ? "coalescing" : "queueing", options.fhss ? "fhss" : "hop on demand",
+        options.burst ? "burst" : "independent", options.jammed, options.seconds, options.loop_us,
+        (unsigned long long)options.seed);
+    for(uint32_t rate: rates) {
+        for(uint8_t size: sizes) {
+            runOne(options, rate, size);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+// FecEncoder/FecDecoder的往返校验：随机长度、随机内容、序号不连续（模拟合并模式）的帧逐组编码，
+// 每组随机丢掉至多一帧，检查校验帧能否原样还原丢失的帧、不丢帧时不还原出帧；
+// 另有一部分组的校验帧推迟到之后的若干帧之后才送达，组内的帧可能已被覆盖，检查不会还原出错误或早已收到的旧帧。
+// 编译运行（全部通过时返回0）：
+//     g++ -std=c++17 -O2 -I.. fec-check.cpp -o fec-check && ./fec-check
+// 参数：
+//     -g <组数>    校验的组数，默认20000
+//     -s <种子>    随机数种子，默认1
+
+#include <getopt.h>
+#include <stdlib.h>
+
+#include "fec.hpp"
+
+using namespace RCBridge;
+
+int main(int argc, char** argv) {
+    uint32_t ngroup = 20000;
+    unsigned seed = 1;
+    int opt;
+    while((opt = getopt(argc, argv, "g:s:")) != -1) {
+        switch(opt) {
+        case 'g':
+            ngroup = atoi(optarg);
+            break;
+        case 's':
+            seed = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-g groups] [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+    srand(seed);
+
+    FecEncoder encoder;
+    FecDecoder decoder;
+    uint8_t frames[FecEncoder::WINDOW][250];
+    uint8_t lens[FecEncoder::WINDOW];
+    // 从回绕前开始，覆盖序号回绕
+    uint16_t seq = 65000;
+    uint32_t nok = 0, nbad = 0, nlate = 0;
+    for(uint32_t g = 0; g < ngroup; g++) {
+        // 每帧前至多空一个序号，k不超过WINDOW/2时组内的跨度不会超出窗口而提前结束
+        uint8_t k = 2 + rand() % (FecEncoder::WINDOW / 2 - 1);
+        encoder.begin(k);
+        // 丢掉第lost帧，不小于组内帧数时不丢
+        uint8_t lost = rand() % (k + 1);
+        uint8_t parity[250];
+        uint8_t parity_len = 0;
+        uint8_t n = 0;
+        while(parity_len == 0) {
+            // 合并模式下被取代的帧不发出，序号出现空缺
+            if(rand() % 4 == 0) {
+                seq++;
+            }
+            uint8_t* frame = frames[n];
+            lens[n] = FecEncoder::SKIP + 4 + rand() % (250 - FecEncoder::HEADER_SIZE - 4);
+            frame[0] = 6;
+            frame[1] = (uint8_t)seq;
+            frame[2] = (uint8_t)(seq >> 8);
+            for(uint8_t i = FecEncoder::SKIP; i < lens[n]; i++) {
+                frame[i] = rand();
+            }
+            seq++;
+            bool done = encoder.add(frame, lens[n]);
+            if(n != lost) {
+                decoder.add(frame, lens[n]);
+            }
+            n++;
+            if(done) {
+                parity_len = encoder.take(11, parity);
+            }
+        }
+        // 校验帧晚到：此前已收到之后的至多一个窗口的帧
+        bool late = rand() % 4 == 0;
+        if(late) {
+            uint8_t later = 1 + rand() % FecEncoder::WINDOW;
+            for(uint8_t i = 0; i < later; i++, seq++) {
+                uint8_t frame[FecEncoder::SKIP + 4] = {6, (uint8_t)seq, (uint8_t)(seq >> 8)};
+                decoder.add(frame, sizeof(frame));
+            }
+        }
+        uint8_t out[250];
+        uint8_t m = decoder.recover(parity, parity_len, 6, out);
+        bool restored = lost < n && m == lens[lost] && memcmp(out, frames[lost], m) == 0;
+        bool ok;
+        if(late) {
+            // 组内的帧未被覆盖时仍应还原，被覆盖时不还原
+            ok = m == 0 || restored;
+            nlate++;
+        }
+        else {
+            ok = lost < n ? restored : m == 0;
+        }
+        if(ok) {
+            nok++;
+        }
+        else {
+            nbad++;
+            if(nbad <= 10) {
+                printf("group %u: k = %u, frames = %u, lost = %u, late = %d, recovered %u bytes\n",
+                        g, k, n, lost, late, m);
+            }
+        }
+    }
+    printf("%u groups (%u late parity): ok %u, bad %u, recovered %u, unrecoverable %u\n",
+            ngroup, nlate, nok, nbad, decoder.nrecovered, decoder.nunrecoverable);
+    return nbad == 0 ? 0 : 1;
+}
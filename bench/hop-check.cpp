@@ -0,0 +1,153 @@
+// 按需跳频的跳频回复失败后的恢复检查：发送端发出跳频命令后离开信道（比如开始恢复扫描），
+// 接收端的跳频回复因此失败；发送端回到原信道继续发送后，检查接收端留在原信道、不再认为跳频未完成，
+// 遥测帧照常回传，且下一次跳频命令照常执行。
+// 编译运行（通过时返回0）：
+//     g++ -std=c++17 -O2 -I.. hop-check.cpp -o hop-check && ./hop-check
+
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "bench.hpp"
+
+using namespace RCBridge;
+
+// 暴露出protected成员，以便预先写好配置和配对信息，并注入跳频命令
+template <typename T>
+class Node: public T {
+
+public:
+    void setup(const char* root, const char* dir, const char* json) {
+        char path[300];
+        snprintf(path, sizeof(path), "%s/%s", root, dir);
+        mkdir(path, 0755);
+        this->fs.setRoot(root);
+        String fpath(dir);
+        fpath.concat("/");
+        fpath.concat(T::FNAME_JSON);
+        this->fs.write(fpath.c_str(), json, strlen(json));
+    }
+
+    const uint8_t* address() const {
+        return this->radio.address();
+    }
+
+    void pair(const uint8_t* addr) {
+        memcpy(this->peer.addr, addr, 6);
+        memset(this->peer.key, 0x5a, sizeof(this->peer.key));
+        this->fs.write(T::FPATH_PEER, &this->peer, sizeof(this->peer));
+    }
+
+    uint8_t radioChannel() {
+        return this->radio.getChannel();
+    }
+
+    bool setRadioChannel(uint8_t channel) {
+        return this->radio.setChannel(channel);
+    }
+
+    // 接收端当前的信道和跳频回复选出的信道
+    uint8_t currentChannel() const {
+        return this->T::channel;
+    }
+
+    uint8_t newChannel() const {
+        return this->new_channel;
+    }
+
+    // 模拟收到发送端的跳频命令
+    void injectHop() {
+        uint8_t command[1] = {T::CMD_HOP};
+        this->onReceived(this->peer.addr, command, sizeof(command));
+    }
+
+};
+
+static Node<BenchSender> sender;
+static Node<BenchReceiver> receiver;
+
+// 以50Hz发送数据、10Hz回传遥测，运行us微秒，返回发送端收到的遥测帧数
+static uint32_t run(uint64_t us) {
+    HAL::Medium& medium = HAL::Medium::instance();
+    uint32_t ntelemetry = sender.ntelemetry;
+    uint64_t end = HAL::Clock::now() + us;
+    uint64_t next_send = HAL::Clock::now();
+    uint64_t next_telemetry = HAL::Clock::now();
+    while(HAL::Clock::now() < end) {
+        if(HAL::Clock::now() >= next_send) {
+            sender.sendBench(23);
+            next_send += 20000;
+        }
+        if(HAL::Clock::now() >= next_telemetry) {
+            uint8_t telemetry[16] = {0};
+            receiver.sendTelemetry(sizeof(telemetry), telemetry);
+            next_telemetry += 100000;
+        }
+        medium.run(50);
+        sender.loop();
+        receiver.loop();
+    }
+    return sender.ntelemetry - ntelemetry;
+}
+
+int main() {
+    char root[] = "/tmp/rc-bridge-hop-check-XXXXXX";
+    if(mkdtemp(root) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    HAL::print_stream = nullptr;
+    HAL::Clock::useVirtual();
+    HAL::Medium& medium = HAL::Medium::instance();
+    medium.reset();
+    medium.seed(1);
+    medium.setTiming(HAL::LinkTiming());
+    char sender_root[64], receiver_root[64];
+    snprintf(sender_root, sizeof(sender_root), "%s/s", root);
+    snprintf(receiver_root, sizeof(receiver_root), "%s/r", root);
+    mkdir(sender_root, 0755);
+    mkdir(receiver_root, 0755);
+    sender.setup(sender_root, "sender", "{}");
+    receiver.setup(receiver_root, "receiver", "{\"telemetry.rate\": 10}");
+    sender.pair(receiver.address());
+    receiver.pair(sender.address());
+    if(!receiver.begin() || !sender.begin()) {
+        fprintf(stderr, "failed to start nodes in <%s>\n", root);
+        return 1;
+    }
+    bool ok = true;
+    uint32_t before = run(1000000);
+    printf("before: channel %u, telemetry received %u\n", receiver.currentChannel(), before);
+    ok &= before > 0;
+
+    // 跳频命令到达后发送端离开信道，跳频回复失败；之后发送端回到原信道
+    uint8_t channel = sender.radioChannel();
+    sender.setRadioChannel(channel == 1 ? 2 : 1);
+    receiver.injectHop();
+    for(int i = 0; i < 200; i++) {
+        medium.run(50);
+        receiver.loop();
+    }
+    sender.setRadioChannel(channel);
+    uint32_t after = run(5000000);
+    printf("after failed reply: channel %u, new channel %u, telemetry received %u\n",
+        receiver.currentChannel(), receiver.newChannel(), after);
+    ok &= receiver.currentChannel() == channel && receiver.newChannel() == channel && after > 0;
+
+    // 下一次跳频命令的回复成功，接收端照常跳到新信道
+    receiver.injectHop();
+    uint8_t hopped = receiver.newChannel();
+    for(int i = 0; i < 200; i++) {
+        medium.run(50);
+        receiver.loop();
+    }
+    printf("after next hop: channel %u, new channel %u\n", receiver.currentChannel(), hopped);
+    ok &= receiver.currentChannel() == hopped;
+
+    char command[320];
+    snprintf(command, sizeof(command), "rm -rf %s", root);
+    if(system(command) != 0) {
+        fprintf(stderr, "failed to remove <%s>\n", root);
+    }
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include "hal.hpp"
+#include "sbus.hpp"
+
+namespace RCBridge {
+
+// 遥控通道的帧间压缩：通道值在相邻帧之间变化很小，却每帧都要传全部16个通道。
+// 编码器每隔若干帧发一个完整的关键帧，其间只发相对于最近关键帧变化了的通道：
+//     关键帧：{0x80 | <7位关键帧号>, <23字节SBUS有效载荷>}，共24字节
+//     差分帧：{<7位关键帧号>, <2字节通道位图，小端>, <标志字节>, <各变化通道的差值>...}，共4+n字节
+// 差值为当前值减去关键帧中的值，zigzag映射为无符号数后按varint编码（每字节7位，最高位表示后面还有），
+// 摇杆微动时每个通道1字节，11位通道的任意差值不超过2字节。
+// 差分帧只依赖关键帧而不依赖前一帧，所以丢失的差分帧不影响后续帧；丢失关键帧时，
+// 后续引用它的差分帧被丢弃，直到下一个关键帧，所以关键帧间隔不宜太长
+class ChannelEncoder {
+
+public:
+    // 编码结果的最大字节数，即关键帧的长度
+    static constexpr uint8_t MAX_SIZE = 1 + SBusFrame::PAYLOAD_SIZE;
+    static constexpr uint8_t KEYFRAME = 0x80;
+
+protected:
+    // 关键帧间隔（帧数），以及距上一个关键帧已编码的帧数
+    uint8_t interval;
+    uint8_t since_key;
+    // 最近关键帧的帧号和内容
+    uint8_t key_id;
+    SBusFrame key;
+
+public:
+    // 统计：编码的关键帧数、差分帧数，以及编码前后的总字节数
+    uint32_t nkey;
+    uint32_t ndelta;
+    uint64_t nraw_bytes;
+    uint64_t nbytes;
+
+public:
+    ChannelEncoder() {
+        begin(0);
+    }
+
+    // 每interval帧发送一个关键帧，0表示只发关键帧
+    void begin(uint8_t interval) {
+        this->interval = interval;
+        since_key = 0;
+        key_id = 0;
+        key.reset();
+        nkey = 0;
+        ndelta = 0;
+        nraw_bytes = 0;
+        nbytes = 0;
+    }
+
+    // 下一帧编码为关键帧，用于上一个关键帧未能发出（比如在发送队列中被新帧取代）的场合
+    void requestKeyframe() {
+        since_key = interval;
+    }
+
+    // 把frame编码到out中，out至少MAX_SIZE字节，返回编码后的字节数
+    uint8_t encode(const SBusFrame& frame, uint8_t* out) {
+        uint8_t len = 0;
+        // 差分帧不比关键帧短时（比如大幅打杆）也直接发关键帧
+        if(nkey != 0 && since_key < interval) {
+            len = encodeDelta(frame, out);
+        }
+        if(len == 0) {
+            key_id = (key_id + 1) & 0x7f;
+            key = frame;
+            since_key = 0;
+            out[0] = KEYFRAME | key_id;
+            frame.encodePayload(out + 1);
+            len = MAX_SIZE;
+            nkey++;
+        }
+        else {
+            ndelta++;
+        }
+        since_key++;
+        nraw_bytes += SBusFrame::PAYLOAD_SIZE;
+        nbytes += len;
+        return len;
+    }
+
+protected:
+    // 编码为差分帧，不比关键帧短时返回0
+    uint8_t encodeDelta(const SBusFrame& frame, uint8_t* out) {
+        uint16_t mask = 0;
+        uint8_t len = 4;
+        for(uint8_t i = 0; i < SBusFrame::NUM_CHANNELS; i++) {
+            int16_t delta = (int16_t)((frame.channels[i] & 0x07ff) - (key.channels[i] & 0x07ff));
+            if(delta == 0) {
+                continue;
+            }
+            if(len + 2 > MAX_SIZE - 1) {
+                return 0;
+            }
+            mask |= 1 << i;
+            uint16_t value = (uint16_t)((uint16_t)delta << 1) ^ (uint16_t)(delta >> 15);
+            while(value >= 0x80) {
+                out[len++] = (uint8_t)(value | 0x80);
+                value >>= 7;
+            }
+            out[len++] = (uint8_t)value;
+        }
+        out[0] = key_id;
+        out[1] = (uint8_t)mask;
+        out[2] = (uint8_t)(mask >> 8);
+        out[3] = frame.flags;
+        return len;
+    }
+
+};
+
+// ChannelEncoder的解码器
+class ChannelDecoder {
+
+protected:
+    // 是否收到过关键帧，以及最近关键帧的帧号和内容
+    bool has_key;
+    uint8_t key_id;
+    SBusFrame key;
+
+public:
+    // 统计：解码的关键帧数、差分帧数，因引用的关键帧丢失而丢弃的差分帧数，格式错误的帧数
+    uint32_t nkey;
+    uint32_t ndelta;
+    uint32_t nstale;
+    uint32_t nerror;
+
+public:
+    ChannelDecoder() {
+        clear();
+    }
+
+    void clear() {
+        has_key = false;
+        key_id = 0;
+        key.reset();
+        nkey = 0;
+        ndelta = 0;
+        nstale = 0;
+        nerror = 0;
+    }
+
+    // 忘掉记住的关键帧，之后的差分帧都被丢弃，直到下一个关键帧。
+    // 关键帧号只有7位，链路中断较久时新关键帧的帧号可能恰好与记住的相同，差分帧会被错误地应用到旧关键帧上
+    void resync() {
+        has_key = false;
+    }
+
+    // 解码len字节的编码结果到frame中，失败则返回false且不修改frame
+    bool decode(const uint8_t* data, uint8_t len, SBusFrame& frame) {
+        if(len == 0) {
+            nerror++;
+            return false;
+        }
+        if(data[0] & ChannelEncoder::KEYFRAME) {
+            if(len != ChannelEncoder::MAX_SIZE) {
+                nerror++;
+                return false;
+            }
+            key_id = data[0] & 0x7f;
+            key.decodePayload(data + 1);
+            has_key = true;
+            frame = key;
+            nkey++;
+            return true;
+        }
+        if(len < 4) {
+            nerror++;
+            return false;
+        }
+        if(!has_key || data[0] != key_id) {
+            nstale++;
+            return false;
+        }
+        uint16_t mask = data[1] | data[2] << 8;
+        uint16_t channels[SBusFrame::NUM_CHANNELS];
+        uint8_t pos = 4;
+        for(uint8_t i = 0; i < SBusFrame::NUM_CHANNELS; i++) {
+            channels[i] = key.channels[i];
+            if((mask & (1 << i)) == 0) {
+                continue;
+            }
+            uint16_t value = 0;
+            for(uint8_t shift = 0; ; shift += 7) {
+                // 11位通道的差值至多2字节
+                if(pos >= len || shift > 7) {
+                    nerror++;
+                    return false;
+                }
+                uint8_t byte = data[pos++];
+                value |= (uint16_t)(byte & 0x7f) << shift;
+                if((byte & 0x80) == 0) {
+                    break;
+                }
+            }
+            int16_t delta = (int16_t)(value >> 1) ^ -(int16_t)(value & 1);
+            channels[i] = (uint16_t)(key.channels[i] + delta) & 0x07ff;
+        }
+        if(pos != len) {
+            nerror++;
+            return false;
+        }
+        memcpy(frame.channels, channels, sizeof(channels));
+        frame.flags = data[3];
+        ndelta++;
+        return true;
+    }
+
+};
+
+}
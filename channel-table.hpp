@@ -0,0 +1,153 @@
+#pragma once
+
+#include "hal.hpp"
+
+namespace RCBridge {
+
+// 接收端为每个信道维护的质量评分，用于在跳频时选择最好的信道，而不是盲目地跳到相邻信道。
+// 评分为0-255的整数，初始为中性值NEUTRAL：在某信道上收到数据帧时缓慢上升，丢帧时下降，
+// 发送端因该信道质量差而请求跳频时减半。低于中性值的评分随时间（自上次使用以来）逐渐恢复，
+// 使被放弃的信道在干扰消失后有机会被重新选中。只有整数运算，可以放在WiFi回调中
+class ChannelTable {
+
+public:
+    // 信道编号的上限（不含），下标即信道编号
+    static constexpr uint8_t NUM_CHANNELS = 14;
+    static constexpr uint8_t NEUTRAL = 128;
+    // 低于中性值的评分每过AGING_MS（ms）恢复1分，约2分钟从0恢复到中性值
+    static constexpr uint32_t AGING_MS = 1000;
+
+    struct Entry {
+        uint8_t score;
+        // 评分最后一次被更新（或计入恢复）的时刻（ms）
+        uint32_t update_ms;
+        // 最后一次使用该信道的时刻（ms）
+        uint32_t used_ms;
+        // 统计：在该信道上收到的数据帧数、丢失的帧数、被请求跳走的次数
+        uint32_t nframe;
+        uint32_t nlost;
+        uint32_t nhop;
+    };
+
+protected:
+    uint8_t min_channel;
+    uint8_t max_channel;
+    Entry entries[NUM_CHANNELS];
+
+public:
+    ChannelTable(uint8_t min_channel, uint8_t max_channel): min_channel(min_channel), max_channel(max_channel) {
+        clear();
+    }
+
+    void clear() {
+        uint32_t now = HAL::millis();
+        for(uint8_t i = 0; i < NUM_CHANNELS; i++) {
+            entries[i] = {NEUTRAL, now, now, 0, 0, 0};
+        }
+    }
+
+    const Entry& entry(uint8_t channel) const {
+        return entries[channel];
+    }
+
+    // 在channel上收到一帧数据
+    void onFrame(uint8_t channel) {
+        Entry& e = age(channel);
+        e.score += (255 - e.score) >> 5;
+        e.used_ms = HAL::millis();
+        e.nframe++;
+    }
+
+    // 根据序号发现channel上丢失了nlost帧
+    void onLoss(uint8_t channel, uint32_t nlost) {
+        Entry& e = age(channel);
+        for(uint32_t i = 0; i < nlost && e.score > 0; i++) {
+            e.score -= (e.score >> 4) | 1;
+        }
+        e.used_ms = HAL::millis();
+        e.nlost += nlost;
+    }
+
+    // 发送端请求从channel跳走，说明它在发送端看来已经很差
+    void onHop(uint8_t channel) {
+        Entry& e = age(channel);
+        e.score >>= 1;
+        e.used_ms = HAL::millis();
+        e.nhop++;
+    }
+
+    // 计入恢复后的评分
+    uint8_t score(uint8_t channel) {
+        return age(channel).score;
+    }
+
+    // 除current以外评分最高的信道，评分相同时选离current最远的，以远离同一个WiFi网络（约占5个信道）的干扰
+    uint8_t best(uint8_t current) {
+        uint8_t best_channel = current;
+        int best_key = -1;
+        for(uint8_t ch = min_channel; ch <= max_channel; ch++) {
+            if(ch == current) {
+                continue;
+            }
+            uint8_t distance = ch > current ? ch - current : current - ch;
+            int key = (int)score(ch) * NUM_CHANNELS + distance;
+            if(key > best_key) {
+                best_key = key;
+                best_channel = ch;
+            }
+        }
+        return best_channel;
+    }
+
+    // 把min_channel-max_channel各信道计入恢复后的评分依次写入scores，返回字节数，用于持久化
+    uint8_t saveScores(uint8_t* scores) {
+        uint8_t n = 0;
+        for(uint8_t ch = min_channel; ch <= max_channel; ch++) {
+            scores[n++] = score(ch);
+        }
+        return n;
+    }
+
+    // 恢复saveScores()保存的评分，低于中性值的评分从现在起重新开始恢复
+    void loadScores(const uint8_t* scores, uint8_t len) {
+        uint32_t now = HAL::millis();
+        for(uint8_t ch = min_channel; ch <= max_channel && (uint8_t)(ch - min_channel) < len; ch++) {
+            entries[ch].score = scores[ch - min_channel];
+            entries[ch].update_ms = now;
+        }
+    }
+
+    // 转化为每个信道一行的人类可读形式
+    String toString() {
+        String str("channels:\n");
+        uint32_t now = HAL::millis();
+        char buffer[96];
+        for(uint8_t ch = min_channel; ch <= max_channel; ch++) {
+            const Entry& e = age(ch);
+            snprintf(buffer, sizeof(buffer), "\t%2u: score = %3u, frame = %u, lost = %u, hop = %u, idle = %ums\n",
+                ch, e.score, e.nframe, e.nlost, e.nhop, now - e.used_ms);
+            str.concat(buffer);
+        }
+        return str;
+    }
+
+protected:
+    Entry& age(uint8_t channel) {
+        Entry& e = entries[channel];
+        uint32_t now = HAL::millis();
+        uint32_t points = (now - e.update_ms) / AGING_MS;
+        if(e.score >= NEUTRAL || points == 0) {
+            if(e.score >= NEUTRAL) {
+                e.update_ms = now;
+            }
+            return e;
+        }
+        e.score = points >= (uint32_t)(NEUTRAL - e.score) ? NEUTRAL : e.score + points;
+        // 保留不足1分的余数
+        e.update_ms += points * AGING_MS;
+        return e;
+    }
+
+};
+
+}
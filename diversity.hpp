@@ -0,0 +1,158 @@
+#pragma once
+
+#include "hal.hpp"
+#include "replay-window.hpp"
+
+namespace RCBridge {
+
+// 分集接收的两个接收端之间有线链路（UART）上的分帧：{SYNC, <长度n>, <n字节esp-now帧>, <校验和>}，
+// 校验和为长度和各字节之和的低8位取反。接收时逐字节喂入，帧头、长度或校验和不对则丢弃并重新寻找SYNC
+class LinkFramer {
+
+public:
+    static constexpr uint8_t SYNC = 0xa5;
+    // esp-now帧最长250字节
+    static constexpr uint8_t MAX_FRAME = 250;
+    static constexpr uint16_t OVERHEAD = 3;
+
+protected:
+    uint8_t buffer[MAX_FRAME];
+    uint8_t len;
+    // 已收到的帧内字节数，-2表示在寻找SYNC，-1表示在等待长度
+    int16_t pos;
+    uint8_t sum;
+
+public:
+    // 统计：收到的完整帧数（发送方为已发出的帧数）、错误帧数，以及发送方因链路忙而丢弃的帧数
+    uint32_t nframe;
+    uint32_t nerror;
+    uint32_t ndrop;
+
+public:
+    LinkFramer() {
+        clear();
+        nframe = 0;
+        nerror = 0;
+        ndrop = 0;
+    }
+
+    void clear() {
+        pos = -2;
+    }
+
+    // 把len字节的帧编码到out中，out至少len+OVERHEAD字节，返回编码后的字节数
+    static uint16_t encode(const uint8_t* frame, uint8_t len, uint8_t* out) {
+        uint8_t sum = len;
+        out[0] = SYNC;
+        out[1] = len;
+        for(uint8_t i = 0; i < len; i++) {
+            out[2 + i] = frame[i];
+            sum += frame[i];
+        }
+        out[2 + len] = ~sum;
+        return len + OVERHEAD;
+    }
+
+    // 喂入一个字节，返回是否刚好收齐了完整的一帧，由frame()和length()取出
+    bool feed(uint8_t byte) {
+        if(pos == -2) {
+            if(byte == SYNC) {
+                pos = -1;
+            }
+            return false;
+        }
+        if(pos == -1) {
+            if(byte == 0 || byte > MAX_FRAME) {
+                nerror++;
+                pos = byte == SYNC ? -1 : -2;
+                return false;
+            }
+            len = byte;
+            sum = byte;
+            pos = 0;
+            return false;
+        }
+        if(pos < len) {
+            buffer[pos++] = byte;
+            sum += byte;
+            return false;
+        }
+        pos = -2;
+        if((uint8_t)~sum != byte) {
+            nerror++;
+            return false;
+        }
+        nframe++;
+        return true;
+    }
+
+    const uint8_t* frame() const {
+        return buffer;
+    }
+
+    uint8_t length() const {
+        return len;
+    }
+
+};
+
+// 分集接收的输出端合并本机无线和有线链路两路收到的帧：按16位滚动序号取每帧最先到达的一份，
+// 另一份作为重复丢弃。序号展开为32位后用ReplayWindow的位图判重，每帧O(1)。
+// 本机无线收到比窗口更旧的序号不是重复而是发送端重启了序号，直接从该序号重新开始。
+// 冗余模式下也用它合并发送端首发和重发的两份
+class DiversityCombiner {
+
+public:
+    // 统计：由无线、由有线链路最先送达的帧数（后者即被另一个接收端救回的帧）、被丢弃的重复帧数
+    uint32_t nradio;
+    uint32_t nlink;
+    uint32_t nduplicate;
+
+protected:
+    ReplayWindow window;
+    bool started;
+
+public:
+    DiversityCombiner() {
+        clear();
+    }
+
+    void clear() {
+        started = false;
+        nradio = 0;
+        nlink = 0;
+        nduplicate = 0;
+    }
+
+    // 从下一帧的序号重新开始，用于发送端可能重启了的场合（比如链路中断后恢复）
+    void resync() {
+        started = false;
+    }
+
+    // 序号为seq的帧是否是第一份，from_link表示来自有线链路，late表示帧本来就可能晚到（重发或还原出的帧）
+    bool accept(uint16_t seq, bool from_link, bool late = false) {
+        uint32_t top = window.top();
+        // 离上次最大序号最近的展开值，从1<<16开始以免回绕到0以下
+        uint32_t counter = started ? top + (int16_t)(seq - (uint16_t)top) : (1u << 16) + seq;
+        // 有线链路上的帧总是晚于无线，重发或还原出的帧本就晚于首发，过旧时只可能是积压，
+        // 只有本机无线收到的首发帧能判定发送端重启
+        if(!started || (!from_link && !late && top - counter < 0x80000000u && top - counter >= ReplayWindow::SIZE)) {
+            window.clear(counter - 1);
+            started = true;
+        }
+        if(!window.check(counter)) {
+            nduplicate++;
+            return false;
+        }
+        if(from_link) {
+            nlink++;
+        }
+        else {
+            nradio++;
+        }
+        return true;
+    }
+
+};
+
+}
@@ -0,0 +1,218 @@
+#pragma once
+
+#include "hal.hpp"
+
+namespace RCBridge {
+
+// 跨帧的异或前向纠错。发送端每发出K个带序号的数据帧，追加一个校验帧，内容为这K帧去掉命令字和序号后
+// （即<4字节发送时刻>和<数据>）按字节异或的结果，以及它们长度的异或；接收端收到校验帧时，
+// 若组内恰好丢了一帧，用其余各帧和校验帧异或即可还原它。每K帧多发一帧，即可补回任意单帧丢失。
+// 校验帧的格式：{CMD_PARITY, <2字节组内第一帧的序号>, <2字节位图，第i位表示序号first+i在组内>,
+// <1字节长度的异或>, <异或的内容>...}，整数为小端，共6+n字节（n为组内最长的一帧的异或部分），比数据帧长3字节。
+// 合并模式下被取代的帧不会发出，所以组内的序号可能不连续，由位图给出
+class FecEncoder {
+
+public:
+    // 组内序号的跨度上限，即位图的位数
+    static constexpr uint8_t WINDOW = 16;
+    // 数据帧中不参与异或的部分：命令字和2字节序号
+    static constexpr uint8_t SKIP = 1 + 2;
+    // 校验帧的帧头
+    static constexpr uint8_t HEADER_SIZE = 1 + 2 + 2 + 1;
+
+protected:
+    // 每组的帧数
+    uint8_t k;
+    // 当前组内的帧数、第一帧的序号、位图、长度的异或、异或的内容及其长度
+    uint8_t count;
+    uint16_t first;
+    uint16_t mask;
+    uint8_t len_xor;
+    uint8_t parity_len;
+    uint8_t parity_data[250 - SKIP];
+    // 是否有已凑齐、等待取走的校验帧
+    bool ready;
+    uint8_t ready_len;
+    uint8_t ready_frame[250];
+
+public:
+    FecEncoder() {
+        begin(0);
+    }
+
+    // 每k帧（2~WINDOW）一个校验帧
+    void begin(uint8_t k) {
+        this->k = k;
+        count = 0;
+        ready = false;
+    }
+
+    // 记下一个发出的带序号的数据帧（不含防重放计数），凑齐一组时返回true，由take()取走校验帧。
+    // 序号超出当前组的跨度时提前结束当前组
+    bool add(const uint8_t* frame, uint8_t len) {
+        if(len < SKIP) {
+            return false;
+        }
+        uint16_t seq = frame[1] | frame[2] << 8;
+        bool done = false;
+        if(count != 0 && (uint16_t)(seq - first) >= WINDOW) {
+            done = finish();
+        }
+        if(count == 0) {
+            first = seq;
+            mask = 0;
+            len_xor = 0;
+            parity_len = 0;
+        }
+        uint8_t n = len - SKIP;
+        for(uint8_t i = 0; i < n; i++) {
+            parity_data[i] = i < parity_len ? parity_data[i] ^ frame[SKIP + i] : frame[SKIP + i];
+        }
+        if(n > parity_len) {
+            parity_len = n;
+        }
+        len_xor ^= n;
+        mask |= 1 << (uint16_t)(seq - first);
+        if(++count >= k) {
+            done = finish();
+        }
+        return done;
+    }
+
+    // 取走校验帧，command为校验帧的命令字，返回帧长，没有时返回0
+    uint8_t take(uint8_t command, uint8_t* out) {
+        if(!ready) {
+            return 0;
+        }
+        ready = false;
+        memcpy(out, ready_frame, ready_len);
+        out[0] = command;
+        return ready_len;
+    }
+
+protected:
+    // 结束当前组，生成校验帧，只有一帧时不值得发
+    bool finish() {
+        bool ok = count >= 2;
+        if(ok) {
+            ready_frame[1] = (uint8_t)first;
+            ready_frame[2] = (uint8_t)(first >> 8);
+            ready_frame[3] = (uint8_t)mask;
+            ready_frame[4] = (uint8_t)(mask >> 8);
+            ready_frame[5] = len_xor;
+            memcpy(ready_frame + HEADER_SIZE, parity_data, parity_len);
+            ready_len = HEADER_SIZE + parity_len;
+            ready = true;
+        }
+        count = 0;
+        return ok;
+    }
+
+};
+
+// FecEncoder的解码端，记住最近WINDOW个序号的帧，收到校验帧时还原组内唯一丢失的一帧
+class FecDecoder {
+
+public:
+    static constexpr uint8_t WINDOW = FecEncoder::WINDOW;
+    static constexpr uint8_t SKIP = FecEncoder::SKIP;
+
+protected:
+    // 按序号对WINDOW取模存放的最近的帧（只存异或部分）
+    struct {
+        bool valid;
+        uint16_t seq;
+        uint8_t len;
+        uint8_t data[250 - SKIP];
+    } slots[WINDOW];
+
+public:
+    // 统计：收到的校验帧数、还原的帧数、组内丢了不止一帧而无法还原的次数
+    uint32_t nparity;
+    uint32_t nrecovered;
+    uint32_t nunrecoverable;
+
+public:
+    FecDecoder() {
+        clear();
+    }
+
+    void clear() {
+        for(uint8_t i = 0; i < WINDOW; i++) {
+            slots[i].valid = false;
+        }
+        nparity = 0;
+        nrecovered = 0;
+        nunrecoverable = 0;
+    }
+
+    // 记下收到的带序号的数据帧（不含防重放计数）
+    void add(const uint8_t* frame, uint8_t len) {
+        if(len < SKIP) {
+            return;
+        }
+        uint16_t seq = frame[1] | frame[2] << 8;
+        auto& slot = slots[seq % WINDOW];
+        slot.valid = true;
+        slot.seq = seq;
+        slot.len = len - SKIP;
+        memcpy(slot.data, frame + SKIP, slot.len);
+    }
+
+    // 用len字节的校验帧还原组内唯一丢失的一帧，以command为命令字写入out（至少250字节），
+    // 返回还原出的帧长；组内没有丢帧、丢了不止一帧，或校验帧晚到、组内的帧已被更新的序号覆盖时返回0
+    uint8_t recover(const uint8_t* parity, uint8_t len, uint8_t command, uint8_t* out) {
+        if(len < FecEncoder::HEADER_SIZE) {
+            return 0;
+        }
+        nparity++;
+        uint16_t first = parity[1] | parity[2] << 8;
+        uint16_t mask = parity[3] | parity[4] << 8;
+        uint8_t n = parity[5];
+        uint8_t parity_len = len - FecEncoder::HEADER_SIZE;
+        const uint8_t* parity_data = parity + FecEncoder::HEADER_SIZE;
+        int16_t missing = -1;
+        for(uint8_t i = 0; i < WINDOW; i++) {
+            if((mask & (1 << i)) == 0) {
+                continue;
+            }
+            const auto& slot = slots[(uint16_t)(first + i) % WINDOW];
+            if(slot.valid && slot.seq == (uint16_t)(first + i)) {
+                n ^= slot.len;
+                continue;
+            }
+            // 已被之后的帧覆盖，无从判断是否丢失，还原出的也只会是早已收到的旧帧
+            if(slot.valid && (int16_t)(slot.seq - (uint16_t)(first + i)) > 0) {
+                return 0;
+            }
+            if(missing >= 0) {
+                nunrecoverable++;
+                return 0;
+            }
+            missing = i;
+        }
+        if(missing < 0 || n > parity_len) {
+            return 0;
+        }
+        uint16_t seq = first + missing;
+        out[0] = command;
+        out[1] = (uint8_t)seq;
+        out[2] = (uint8_t)(seq >> 8);
+        memcpy(out + SKIP, parity_data, n);
+        for(uint8_t i = 0; i < WINDOW; i++) {
+            if((mask & (1 << i)) == 0 || i == missing) {
+                continue;
+            }
+            const auto& slot = slots[(uint16_t)(first + i) % WINDOW];
+            uint8_t m = slot.len < n ? slot.len : n;
+            for(uint8_t j = 0; j < m; j++) {
+                out[SKIP + j] ^= slot.data[j];
+            }
+        }
+        nrecovered++;
+        return SKIP + n;
+    }
+
+};
+
+}
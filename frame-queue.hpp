@@ -0,0 +1,149 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace RCBridge {
+
+// 定长槽位、固定容量的单生产者单消费者无锁环形队列，不分配内存。
+// 生产者（如esp-now的接收回调）用memcpy写入一帧，耗时恒定；消费者（如loop()）就地读取后释放。
+// head只由生产者修改，tail只由消费者修改，二者都单调递增，对CAPACITY取模得到槽位下标
+template <size_t SLOT_SIZE, size_t CAPACITY>
+class FrameQueue {
+
+    static_assert(CAPACITY >= 2 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+    static_assert(SLOT_SIZE <= 255, "SLOT_SIZE must fit in uint8_t");
+
+public:
+    // 队列满时的策略
+    enum Policy: uint8_t {
+        // 丢弃新来的帧
+        DROP_NEWEST,
+        // 用新来的帧覆盖队列中最新的那一帧，适合只关心最新值的数据（如遥控通道）。
+        // 队列满时最新的一帧与消费者正在读的最旧的一帧必然不是同一个槽位，所以覆盖是安全的
+        OVERWRITE_NEWEST,
+    };
+
+    struct Slot {
+        uint8_t len;
+        uint8_t data[SLOT_SIZE];
+    };
+
+protected:
+    Slot slots[CAPACITY];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    Policy policy;
+
+public:
+    // 统计：成功入队的帧数、被丢弃的帧数、被覆盖的帧数、队列长度的历史最大值
+    volatile uint32_t npush;
+    volatile uint32_t ndrop;
+    volatile uint32_t noverwrite;
+    volatile uint32_t max_size;
+
+public:
+    FrameQueue(Policy policy = DROP_NEWEST): policy(policy) {
+        clear();
+    }
+
+    void setPolicy(Policy policy) {
+        this->policy = policy;
+    }
+
+    // 清空队列和统计，只能在生产者和消费者都不活动时调用
+    void clear() {
+        head = 0;
+        tail = 0;
+        npush = 0;
+        ndrop = 0;
+        noverwrite = 0;
+        max_size = 0;
+    }
+
+    size_t size() const {
+        return head - tail;
+    }
+
+    // 生产者调用，入队一帧，len超过SLOT_SIZE或者队列满且策略为DROP_NEWEST时返回false
+    bool push(const void* data, size_t len) {
+        if(len > SLOT_SIZE) {
+            ndrop++;
+            return false;
+        }
+        uint32_t h = head;
+        uint32_t n = h - tail;
+        if(n >= CAPACITY) {
+            if(policy == DROP_NEWEST) {
+                ndrop++;
+                return false;
+            }
+            Slot& slot = slots[(h - 1) & (CAPACITY - 1)];
+            slot.len = len;
+            memcpy(slot.data, data, len);
+            noverwrite++;
+            return true;
+        }
+        Slot& slot = slots[h & (CAPACITY - 1)];
+        slot.len = len;
+        memcpy(slot.data, data, len);
+        // 确保槽位内容先于head对消费者可见
+        __sync_synchronize();
+        head = h + 1;
+        npush++;
+        if(n + 1 > max_size) {
+            max_size = n + 1;
+        }
+        return true;
+    }
+
+    // 生产者调用，返回下一个空槽位以便就地写入，省去push()的拷贝，队列满则返回nullptr。
+    // 写好slot.len和数据后调用commit()入队，在此之前消费者看不到该槽位
+    Slot* acquire() {
+        uint32_t h = head;
+        if(h - tail >= CAPACITY) {
+            return nullptr;
+        }
+        return &slots[h & (CAPACITY - 1)];
+    }
+
+    // 生产者调用，入队acquire()返回的槽位
+    void commit() {
+        uint32_t h = head;
+        // 确保槽位内容先于head对消费者可见
+        __sync_synchronize();
+        head = h + 1;
+        npush++;
+        uint32_t n = h + 1 - tail;
+        if(n > max_size) {
+            max_size = n;
+        }
+    }
+
+    // 消费者调用，返回最旧的一帧，队列为空则返回nullptr
+    const Slot* front() const {
+        uint32_t t = tail;
+        if(head == t) {
+            return nullptr;
+        }
+        // 确保读槽位内容发生在读head之后
+        __sync_synchronize();
+        return &slots[t & (CAPACITY - 1)];
+    }
+
+    // 同上，消费者可就地修改这一帧（比如发出前在末尾附加内容）
+    Slot* front() {
+        return const_cast<Slot*>(static_cast<const FrameQueue*>(this)->front());
+    }
+
+    // 消费者调用，释放front()返回的那一帧
+    void pop() {
+        // 确保对槽位的读取先于tail的更新完成
+        __sync_synchronize();
+        tail = tail + 1;
+    }
+
+};
+
+}
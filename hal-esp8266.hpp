@@ -0,0 +1,310 @@
+#pragma once
+
+#include <espnow.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266WebServer.h>
+
+#include "log-level.hpp"
+
+extern "C" {
+#include <user_interface.h>
+}
+
+// 调试信息输出的串口。桥接SBUS时UART0被占用，可在include之前定义为Serial1（GPIO2，仅发送）
+#ifndef RCB_DEBUG_PORT
+#define RCB_DEBUG_PORT Serial
+#endif
+
+namespace RCBridge {
+
+namespace HAL {
+
+// 串口，输出调试信息
+template <typename... T>
+void print(const char* format, T... args) {
+    RCB_DEBUG_PORT.printf(format, args...);
+}
+
+// 不阻塞地还能输出的字节数，即串口发送缓冲的空闲
+inline size_t printAvailable() {
+    return RCB_DEBUG_PORT.availableForWrite();
+}
+
+// 时钟
+inline uint32_t micros() {
+    return ::micros();
+}
+
+inline uint32_t millis() {
+    return ::millis();
+}
+
+// CPU的周期计数器，分辨率远高于micros()，且读取只需一条指令
+inline uint32_t cycleCount() {
+    return ESP.getCycleCount();
+}
+
+inline uint32_t cpuFreqMHz() {
+    return ESP.getCpuFreqMHz();
+}
+
+// 随机数
+inline void randomBytes(uint8_t* buffer, size_t len) {
+    randomSeed(::micros());
+    for(size_t i = 0; i < len; i++) {
+        buffer[i] = (uint8_t)random(0, 256);
+    }
+}
+
+// 文件系统，基于LittleFS
+class FileSystem {
+
+public:
+    bool exists(const char* path) {
+        return LittleFS.exists(path);
+    }
+
+    bool remove(const char* path) {
+        return LittleFS.remove(path);
+    }
+
+    // 读取至多len字节，返回读到的字节数，打开失败返回-1
+    int read(const char* path, void* buffer, size_t len) {
+        File file = LittleFS.open(path, "r");
+        if(!file) {
+            return -1;
+        }
+        size_t nread = file.readBytes((char*)buffer, len);
+        file.close();
+        return nread;
+    }
+
+    // 覆盖写入len字节，返回写入的字节数，打开失败返回-1
+    int write(const char* path, const void* data, size_t len) {
+        File file = LittleFS.open(path, "w");
+        if(!file) {
+            return -1;
+        }
+        size_t nwrite = file.write((const uint8_t*)data, len);
+        file.close();
+        return nwrite;
+    }
+
+    bool readString(const char* path, String& content) {
+        File file = LittleFS.open(path, "r");
+        if(!file) {
+            return false;
+        }
+        content = file.readString();
+        file.close();
+        return true;
+    }
+
+};
+
+// 配置，以json对象的形式存放在文件中
+class Config {
+
+protected:
+    String fpath;
+    DynamicJsonDocument json;
+
+public:
+    Config(): json(8) {}
+
+    bool load(FileSystem& fs, const String& fpath) {
+        this->fpath = fpath;
+        File file = LittleFS.open(fpath, "r");
+        if(!file) {
+            RCB_LOGW("failed to open <%s> to read...\n", fpath.c_str());
+            return false;
+        }
+        size_t fsize = file.size();
+        json = DynamicJsonDocument(fsize * 2);
+        auto err = deserializeJson(json, file);
+        file.close();
+        if(err) {
+            RCB_LOGW("failed to parse <%s> as json...\n", fpath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool save(FileSystem& fs) {
+        File file = LittleFS.open(fpath, "w");
+        if(!file) {
+            RCB_LOGW("failed to open <%s> to write...\n", fpath.c_str());
+            return false;
+        }
+        serializeJson(json, file);
+        file.close();
+        return true;
+    }
+
+    // 读取字符串配置项，不存在时返回空串
+    String get(const char* key) const {
+        return String(json[key].as<const char*>());
+    }
+
+    // 读取整数配置项。Web页面提交的值都是字符串，所以数字和字符串两种形式都支持，
+    // 不存在或为空时返回默认值
+    long getInt(const char* key, long default_value) const {
+        JsonVariantConst value = json[key];
+        if(value.is<long>()) {
+            return value.as<long>();
+        }
+        const char* str = value.as<const char*>();
+        if(str == nullptr || str[0] == 0) {
+            return default_value;
+        }
+        return atol(str);
+    }
+
+    void set(const String& key, const String& value) {
+        json[key] = value;
+    }
+
+    // 遍历所有配置项，f(const char* key, const char* value)，非字符串的值视为空串
+    template <typename F>
+    void forEach(F f) const {
+        for(JsonPairConst kv: json.as<JsonObjectConst>()) {
+            const char* value = kv.value().as<const char*>();
+            f(kv.key().c_str(), value ? value : "");
+        }
+    }
+
+};
+
+// Web服务以及其所在的WiFi热点，基于ESP8266WebServer
+class WebServer: public ESP8266WebServer {
+
+public:
+    WebServer(): ESP8266WebServer(80) {}
+
+    // 以name和password建立WiFi热点，并在ip_addr:80上启动Web服务，password为nullptr表示不加密
+    bool begin(const String& name, const char* password, const char* ip_addr) {
+        if(!WiFi.mode(WIFI_AP)) {
+            RCB_LOGE("failed to switch to AP mode...\n");
+            return false;
+        }
+        if(!WiFi.softAP(name, password)) {
+            RCB_LOGE("failed to setup WiFi access point...\n");
+            return false;
+        }
+        RCB_LOGI("WiFi access point <%s> setup...\n", name.c_str());
+        IPAddress ip;
+        ip.fromString(ip_addr);
+        if(!WiFi.softAPConfig(ip, ip, IPAddress(255, 255, 255, 0))) {
+            RCB_LOGE("failed to set IP to <%s>...\n", ip_addr);
+            return false;
+        }
+        ESP8266WebServer::begin();
+        return true;
+    }
+
+    static String macAddress() {
+        return WiFi.softAPmacAddress();
+    }
+
+};
+
+// 串口，用于分集接收的两个接收端之间的有线链路，使用UART0。接收端UART0的发送被SBUS输出占用，
+// 而UART的收发只能用同一设置，所以链路也是100000波特率8E2反相，此时调试信息须改由Serial1输出
+class SerialPort {
+
+public:
+    bool begin(bool rx, bool tx) {
+        Serial.begin(100000, SERIAL_8E2, rx && tx ? SERIAL_FULL : (rx ? SERIAL_RX_ONLY : SERIAL_TX_ONLY), 1, true);
+        return true;
+    }
+
+    // 读取一个已到达的字节，没有则返回-1
+    int read() {
+        return Serial.read();
+    }
+
+    // 发送FIFO中的空余字节数，写入不超过它就不会阻塞
+    size_t availableForWrite() {
+        return Serial.availableForWrite();
+    }
+
+    size_t write(const uint8_t* data, size_t len) {
+        return Serial.write(data, len);
+    }
+
+};
+
+// 无线收发事件的处理者
+class RadioHandler {
+
+public:
+    // 发送完成，status为0表示对端已确认（广播则仅表示已发出）
+    virtual void onSent(uint8_t* addr, uint8_t status) = 0;
+
+    virtual void onReceived(uint8_t* addr, uint8_t* data, uint8_t len) = 0;
+
+};
+
+// 无线，基于esp-now
+class Radio {
+
+public:
+    bool begin(RadioHandler* handler) {
+        if(esp_now_init() != 0) {
+            RCB_LOGE("failed to initialize esp-now...\n");
+            return false;
+        }
+        if(esp_now_set_self_role(ESP_NOW_ROLE_COMBO) != 0) {
+            RCB_LOGE("failed to set esp-now role as combo...\n");
+            return false;
+        }
+        // espnow的回调函数无法带user defined argument，只能通过全局变量转入成员方法中，
+        // 不过好在不管是发送端还是接收端都是全局单例的
+        static RadioHandler* instance;
+        instance = handler;
+        int ret = esp_now_register_send_cb([](uint8_t* addr, uint8_t status) {
+            instance->onSent(addr, status);
+        });
+        if(ret != 0) {
+            RCB_LOGE("failed to register send callback...\n");
+            return false;
+        }
+        ret = esp_now_register_recv_cb([](uint8_t* addr, uint8_t* data, uint8_t len) {
+            instance->onReceived(addr, data, len);
+        });
+        if(ret != 0) {
+            RCB_LOGE("failed to register receive callback...\n");
+            return false;
+        }
+        return true;
+    }
+
+    // 覆盖本机的MAC地址，须在begin()之前调用。WiFi工作在AP模式，esp-now用的是AP接口的地址
+    bool setAddress(const uint8_t* mac) {
+        return wifi_set_macaddr(SOFTAP_IF, (uint8_t*)mac);
+    }
+
+    // espnow本质就是802.11的帧，所以设置wifi信道就是设置espnow的信道
+    bool setChannel(uint8_t channel) {
+        return wifi_set_channel(channel);
+    }
+
+    uint8_t getChannel() const {
+        return wifi_get_channel();
+    }
+
+    bool addPeer(const uint8_t* addr, const uint8_t* key, uint8_t key_len) {
+        return esp_now_add_peer((uint8_t*)addr, ESP_NOW_ROLE_COMBO, 0, (uint8_t*)key, key_len) == 0;
+    }
+
+    bool send(const uint8_t* addr, const uint8_t* data, uint8_t len) {
+        return esp_now_send((uint8_t*)addr, (uint8_t*)data, len) == 0;
+    }
+
+};
+
+}
+
+}
@@ -0,0 +1,523 @@
+#pragma once
+
+#include <queue>
+
+namespace RCBridge {
+
+namespace HAL {
+
+// 信道模型：Gilbert-Elliott两状态马尔可夫链，好、坏两个状态各有自己的丢帧率，
+// 信道上每传输一帧（包括确认帧）转移一次状态。1/p_bad_to_good为突发的平均长度（帧），
+// 1/p_good_to_bad为两次突发之间的平均间隔（帧）
+struct ChannelModel {
+
+    double loss_good;
+    double loss_bad;
+    double p_good_to_bad;
+    double p_bad_to_good;
+
+    // 理想信道
+    static ChannelModel perfect() {
+        return {0.0, 0.0, 0.0, 1.0};
+    }
+
+    // 独立丢帧，丢帧率为loss
+    static ChannelModel independent(double loss) {
+        return {loss, loss, 0.0, 1.0};
+    }
+
+    // 突发丢帧：好状态的丢帧率为loss_good，平均每隔good_frames帧出现一次平均长burst_frames帧、
+    // 丢帧率为loss_bad的突发
+    static ChannelModel burst(double loss_good, double loss_bad, double good_frames, double burst_frames) {
+        return {loss_good, loss_bad, 1.0 / good_frames, 1.0 / burst_frames};
+    }
+
+};
+
+// 链路时序。默认值大致对应esp-now的1Mbps、长前导码
+struct LinkTiming {
+
+    // 空口比特率（bps）
+    uint32_t bitrate = 1000000;
+    // 每帧除载荷外的固定耗时：长前导码与PLCP头192us，MAC头、esp-now厂商字段及FCS共约43字节
+    uint32_t overhead_us = 192 + 43 * 8;
+    // 等待并接收确认帧的耗时（SIFS+确认帧）
+    uint32_t ack_us = 10 + 192 + 14 * 8;
+    // 未收到确认时的最大重传次数
+    uint8_t retries = 7;
+    // 每次重传前的退避时间（DIFS+平均退避）
+    uint32_t backoff_us = 50 + 150;
+    // 从空口收完到回调执行的处理延迟，以及在其上附加的均匀随机抖动的上限
+    uint32_t latency_us = 100;
+    uint32_t jitter_us = 0;
+    // 每个节点同时在途（尚未回调onSent）的帧数上限，超出时send()失败
+    uint8_t max_pending = 1;
+
+};
+
+class Radio;
+
+// 进程内模拟的无线介质，代替esp-now：
+// - 只向同一信道上的节点投递，每个信道有自己的丢帧模型（见ChannelModel）
+// - 计算空口占用时间，同一信道上的帧依次传输，单播帧有确认和重传，确认帧丢失时对端已收到但发送端判为失败
+// - 回调在事件的时刻由poll()或run()在调用者的上下文中分发，不会重入send()
+// 所有随机数来自可设种子的伪随机数发生器，配合虚拟时钟（Clock::useVirtual()）可快速、可复现地仿真长时间的链路行为。
+// 不模拟加密，密钥被忽略
+class Medium {
+
+public:
+    // 信道编号的上限（不含）
+    static constexpr uint8_t NUM_CHANNELS = 15;
+
+    struct Stats {
+        // send()成功的帧数，以及因在途帧过多而被拒绝的帧数
+        uint64_t nsend;
+        uint64_t nbusy;
+        // 空口传输的次数（含重传），其中数据帧丢失、确认帧丢失的次数
+        uint64_t nattempt;
+        uint64_t nlost;
+        uint64_t nack_lost;
+        // 对端不在同一信道（或不存在）而无法送达的次数
+        uint64_t nmiss;
+        // 投递给接收端的帧数，单播最终失败（onSent的status非0）的帧数
+        uint64_t ndeliver;
+        uint64_t nfail;
+    };
+
+protected:
+    enum EventType: uint8_t {
+        EVENT_SENT,
+        EVENT_RECEIVED,
+        EVENT_TASK,
+        // 单播帧的一次空口传输结束，此时才根据接收端当前所在的信道判定能否收到，
+        // 这样重传期间接收端切换信道的情况也能被正确模拟
+        EVENT_ATTEMPT,
+    };
+
+    struct Event {
+        uint64_t time;
+        // 同一时刻的事件按产生的先后分发
+        uint64_t order;
+        EventType type;
+        Radio* radio;
+        // 收到数据事件、传输事件所在的信道
+        uint8_t channel;
+        // 发送完成事件、传输事件为目的地址，收到数据事件为源地址
+        uint8_t addr[6];
+        uint8_t status;
+        // 传输事件：第几次传输（0为首次），以及之前已投递给了哪些接收端（按地址匹配的先后，每个一位）
+        uint8_t attempt;
+        uint8_t delivered;
+        uint8_t len;
+        uint8_t data[250];
+        std::function<void()> task;
+
+        bool operator>(const Event& e) const {
+            return time != e.time ? time > e.time : order > e.order;
+        }
+    };
+
+protected:
+    std::vector<Radio*> radios;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+    uint64_t next_order;
+    uint8_t next_id;
+    uint64_t rng;
+    LinkTiming timing;
+    ChannelModel models[NUM_CHANNELS];
+    // 各信道当前是否处于坏状态，以及空口被占用到何时
+    bool bad[NUM_CHANNELS];
+    uint64_t busy_until[NUM_CHANNELS];
+
+public:
+    Stats stats;
+
+public:
+    Medium(): next_order(0), next_id(1), rng(1), stats() {
+        for(uint8_t i = 0; i < NUM_CHANNELS; i++) {
+            models[i] = ChannelModel::perfect();
+            bad[i] = false;
+            busy_until[i] = 0;
+        }
+        // 默认没有空口耗时和处理延迟，即理想的瞬时介质
+        timing.overhead_us = 0;
+        timing.ack_us = 0;
+        timing.backoff_us = 0;
+        timing.latency_us = 0;
+        timing.bitrate = 0;
+        timing.max_pending = 255;
+    }
+
+    // 默认的全局介质
+    static Medium& instance() {
+        static Medium medium;
+        return medium;
+    }
+
+    void seed(uint64_t seed) {
+        rng = seed ? seed : 1;
+    }
+
+    void setTiming(const LinkTiming& timing) {
+        this->timing = timing;
+    }
+
+    const LinkTiming& getTiming() const {
+        return timing;
+    }
+
+    // 设置某个信道的丢帧模型，channel为0表示所有信道
+    void setChannelModel(uint8_t channel, const ChannelModel& model) {
+        for(uint8_t i = 0; i < NUM_CHANNELS; i++) {
+            if(channel == 0 || channel == i) {
+                models[i] = model;
+                bad[i] = false;
+            }
+        }
+    }
+
+    // 丢弃未分发的事件，清空统计和各信道的状态（丢帧模型和时序参数保留），
+    // 以便在同一进程中依次进行多次互不影响的仿真
+    void reset();
+
+    // 接入一个节点，并为其分配MAC地址02:00:00:00:00:<序号>
+    void attach(Radio* radio);
+
+    void detach(Radio* radio);
+
+    bool transmit(Radio* from, const uint8_t* addr, const uint8_t* data, uint8_t len);
+
+    // 在当前时刻之后delay_us执行task，供仿真程序安排定时动作
+    void schedule(uint64_t delay_us, std::function<void()> task) {
+        Event event;
+        event.type = EVENT_TASK;
+        event.radio = nullptr;
+        event.task = task;
+        push(Clock::now() + delay_us, event);
+    }
+
+    // 分发所有已到时刻的事件（回调中新产生的、同样已到时刻的事件也一并分发），返回分发的事件数
+    size_t poll() {
+        return dispatchUntil(Clock::now());
+    }
+
+    // 使用虚拟时钟时，将时钟推进到until_us，并依次在各事件的时刻分发事件，返回分发的事件数
+    size_t runUntil(uint64_t until_us) {
+        size_t n = dispatchUntil(until_us);
+        Clock::advanceTo(until_us);
+        return n;
+    }
+
+    size_t run(uint64_t duration_us) {
+        return runUntil(Clock::now() + duration_us);
+    }
+
+    // 在[0, 1)上均匀分布的伪随机数（xorshift64*）
+    double uniform() {
+        rng ^= rng >> 12;
+        rng ^= rng << 25;
+        rng ^= rng >> 27;
+        return (double)((rng * 0x2545f4914f6cdd1dull) >> 11) / (double)(1ull << 53);
+    }
+
+protected:
+    void push(uint64_t time, Event& event) {
+        event.time = time;
+        event.order = next_order++;
+        events.push(event);
+    }
+
+    size_t dispatchUntil(uint64_t until_us);
+
+    void attempt(Event& event);
+
+    // 在channel上传输一帧（数据帧或确认帧），按丢帧模型判定是否丢失
+    bool lose(uint8_t channel) {
+        const ChannelModel& model = models[channel];
+        if(bad[channel]) {
+            bad[channel] = uniform() >= model.p_bad_to_good;
+        }
+        else {
+            bad[channel] = uniform() < model.p_good_to_bad;
+        }
+        return uniform() < (bad[channel] ? model.loss_bad : model.loss_good);
+    }
+
+    uint64_t airTime(uint8_t len) const {
+        return timing.overhead_us + (timing.bitrate ? (uint64_t)len * 8 * 1000000 / timing.bitrate : 0);
+    }
+
+    uint64_t latency() {
+        return timing.latency_us + (uint64_t)(uniform() * timing.jitter_us);
+    }
+
+};
+
+// 无线，接入进程内的Medium
+class Radio {
+
+    friend class Medium;
+
+protected:
+    Medium* medium;
+    RadioHandler* handler;
+    uint8_t mac[6];
+    uint8_t channel;
+    // 在途（尚未回调onSent）的帧数
+    uint8_t pending;
+
+public:
+    Radio(Medium& medium = Medium::instance()): medium(&medium), handler(nullptr), channel(0), pending(0) {
+        medium.attach(this);
+    }
+
+    Radio(const Radio&) = delete;
+
+    ~Radio() {
+        medium->detach(this);
+    }
+
+    bool begin(RadioHandler* handler) {
+        this->handler = handler;
+        return true;
+    }
+
+    bool setChannel(uint8_t channel) {
+        if(channel >= Medium::NUM_CHANNELS) {
+            return false;
+        }
+        this->channel = channel;
+        return true;
+    }
+
+    bool addPeer(const uint8_t* /*addr*/, const uint8_t* /*key*/, uint8_t /*key_len*/) {
+        return true;
+    }
+
+    bool send(const uint8_t* addr, const uint8_t* data, uint8_t len) {
+        if(handler == nullptr || len > 250) {
+            return false;
+        }
+        return medium->transmit(this, addr, data, len);
+    }
+
+    const uint8_t* address() const {
+        return mac;
+    }
+
+    // 覆盖分配的MAC地址，多个节点可以使用同一地址，它们各自接收发往该地址的帧
+    bool setAddress(const uint8_t* mac) {
+        memcpy(this->mac, mac, 6);
+        return true;
+    }
+
+    uint8_t getChannel() const {
+        return channel;
+    }
+
+};
+
+inline void Medium::reset() {
+    events = decltype(events)();
+    stats = Stats();
+    for(uint8_t i = 0; i < NUM_CHANNELS; i++) {
+        bad[i] = false;
+        busy_until[i] = 0;
+    }
+    for(Radio* radio: radios) {
+        radio->pending = 0;
+    }
+}
+
+inline void Medium::attach(Radio* radio) {
+    static const uint8_t prefix[5] = {0x02, 0x00, 0x00, 0x00, 0x00};
+    memcpy(radio->mac, prefix, 5);
+    radio->mac[5] = next_id++;
+    radios.push_back(radio);
+}
+
+inline void Medium::detach(Radio* radio) {
+    for(auto it = radios.begin(); it != radios.end(); ++it) {
+        if(*it == radio) {
+            radios.erase(it);
+            break;
+        }
+    }
+    // 发往该节点的事件在分发时会因找不到节点而被丢弃
+}
+
+inline bool Medium::transmit(Radio* from, const uint8_t* addr, const uint8_t* data, uint8_t len) {
+    static const uint8_t broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    if(from->pending >= timing.max_pending) {
+        stats.nbusy++;
+        return false;
+    }
+    from->pending++;
+    stats.nsend++;
+    uint8_t channel = from->channel;
+    uint64_t air = airTime(len);
+    uint64_t start = Clock::now();
+    if(start < busy_until[channel]) {
+        start = busy_until[channel];
+    }
+    uint64_t end = start + air;
+    if(memcmp(addr, broadcast, 6) == 0) {
+        // 广播没有确认和重传，每个接收者独立判定是否丢失
+        Event received;
+        received.type = EVENT_RECEIVED;
+        received.channel = channel;
+        memcpy(received.addr, from->mac, 6);
+        received.status = 0;
+        received.len = len;
+        memcpy(received.data, data, len);
+        stats.nattempt++;
+        for(Radio* radio: radios) {
+            if(radio == from || radio->handler == nullptr) {
+                continue;
+            }
+            if(radio->channel != channel) {
+                stats.nmiss++;
+            }
+            else if(lose(channel)) {
+                stats.nlost++;
+            }
+            else {
+                received.radio = radio;
+                push(end + latency(), received);
+                stats.ndeliver++;
+            }
+        }
+        Event sent;
+        sent.type = EVENT_SENT;
+        sent.radio = from;
+        memcpy(sent.addr, addr, 6);
+        sent.status = 0;
+        sent.len = 0;
+        busy_until[channel] = end;
+        push(end + latency(), sent);
+        return true;
+    }
+    // 单播在每次传输结束时判定结果，见attempt()
+    Event event;
+    event.type = EVENT_ATTEMPT;
+    event.radio = from;
+    event.channel = channel;
+    memcpy(event.addr, addr, 6);
+    event.len = len;
+    memcpy(event.data, data, len);
+    event.attempt = 0;
+    event.delivered = 0;
+    busy_until[channel] = end + timing.ack_us;
+    push(end, event);
+    return true;
+}
+
+inline void Medium::attempt(Event& event) {
+    uint8_t channel = event.channel;
+    Radio* from = event.radio;
+    stats.nattempt++;
+    // 可能有多个节点使用同一地址（如分集接收），各自独立判定是否收到，任一个的确认送达即算成功
+    bool acked = false;
+    uint8_t ntarget = 0;
+    for(Radio* radio: radios) {
+        if(radio == from || radio->handler == nullptr || memcmp(radio->mac, event.addr, 6) != 0) {
+            continue;
+        }
+        uint8_t bit = 1 << (ntarget++ & 7);
+        if(radio->channel != channel) {
+            stats.nmiss++;
+            continue;
+        }
+        if(lose(channel)) {
+            stats.nlost++;
+            continue;
+        }
+        // 对端的MAC层会过滤重传的重复帧，所以无论重传多少次最多只投递一次
+        if(!(event.delivered & bit)) {
+            Event received;
+            received.type = EVENT_RECEIVED;
+            received.radio = radio;
+            received.channel = channel;
+            memcpy(received.addr, from->mac, 6);
+            received.status = 0;
+            received.len = event.len;
+            memcpy(received.data, event.data, event.len);
+            push(Clock::now() + latency(), received);
+            event.delivered |= bit;
+            stats.ndeliver++;
+        }
+        if(lose(channel)) {
+            stats.nack_lost++;
+        }
+        else {
+            acked = true;
+        }
+    }
+    if(ntarget == 0) {
+        stats.nmiss++;
+    }
+    uint64_t end = Clock::now() + timing.ack_us;
+    if(acked || event.attempt >= timing.retries) {
+        if(!acked) {
+            stats.nfail++;
+        }
+        Event sent;
+        sent.type = EVENT_SENT;
+        sent.radio = from;
+        memcpy(sent.addr, event.addr, 6);
+        sent.status = acked ? 0 : 1;
+        sent.len = 0;
+        push(end + latency(), sent);
+        return;
+    }
+    // 退避后重传，期间信道上的其他帧先传
+    uint64_t start = end + timing.backoff_us;
+    if(start < busy_until[channel]) {
+        start = busy_until[channel];
+    }
+    end = start + airTime(event.len);
+    busy_until[channel] = end + timing.ack_us;
+    event.attempt++;
+    push(end, event);
+}
+
+inline size_t Medium::dispatchUntil(uint64_t until_us) {
+    size_t n = 0;
+    while(!events.empty() && events.top().time <= until_us) {
+        Event event = events.top();
+        events.pop();
+        Clock::advanceTo(event.time);
+        n++;
+        if(event.type == EVENT_TASK) {
+            event.task();
+            continue;
+        }
+        // 节点可能已经离开
+        bool attached = false;
+        for(Radio* radio: radios) {
+            if(radio == event.radio) {
+                attached = true;
+                break;
+            }
+        }
+        if(!attached) {
+            continue;
+        }
+        if(event.type == EVENT_ATTEMPT) {
+            attempt(event);
+        }
+        else if(event.type == EVENT_SENT) {
+            event.radio->pending--;
+            event.radio->handler->onSent(event.addr, event.status);
+        }
+        // 飞行途中接收端切换了信道，则收不到
+        else if(event.radio->channel == event.channel) {
+            event.radio->handler->onReceived(event.addr, event.data, event.len);
+        }
+    }
+    return n;
+}
+
+}
+
+}
@@ -0,0 +1,588 @@
+#pragma once
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "log-level.hpp"
+
+// ESP8266上用于将函数放入IRAM，主机上无意义
+#ifndef IRAM_ATTR
+#define IRAM_ATTR
+#endif
+
+// Arduino String的最小子集，只包含本库用到的方法
+class String {
+
+protected:
+    std::string str;
+
+public:
+    String() {}
+
+    String(const char* cstr) {
+        if(cstr) {
+            str = cstr;
+        }
+    }
+
+    String(const std::string& str): str(str) {}
+
+    const char* c_str() const {
+        return str.c_str();
+    }
+
+    unsigned int length() const {
+        return str.length();
+    }
+
+    bool isEmpty() const {
+        return str.empty();
+    }
+
+    bool concat(const String& s) {
+        str += s.str;
+        return true;
+    }
+
+    bool concat(const char* cstr) {
+        if(cstr) {
+            str += cstr;
+        }
+        return true;
+    }
+
+    bool concat(char c) {
+        str += c;
+        return true;
+    }
+
+    void replace(const String& find, const String& replace) {
+        if(find.str.empty()) {
+            return;
+        }
+        size_t pos = 0;
+        while((pos = str.find(find.str, pos)) != std::string::npos) {
+            str.replace(pos, find.str.length(), replace.str);
+            pos += replace.str.length();
+        }
+    }
+
+    long toInt() const {
+        return atol(str.c_str());
+    }
+
+    bool operator==(const String& s) const {
+        return str == s.str;
+    }
+
+    bool operator<(const String& s) const {
+        return str < s.str;
+    }
+
+};
+
+namespace RCBridge {
+
+namespace HAL {
+
+// 串口所对应的输出流，默认为标准输出，可以改为文件或者置为nullptr以关闭输出（如跑基准时）
+inline FILE* print_stream = stdout;
+
+// 串口，输出调试信息
+template <typename... T>
+void print(const char* format, T... args) {
+    if(print_stream) {
+        fprintf(print_stream, format, args...);
+    }
+}
+
+// 不阻塞地还能输出的字节数，主机上输出不会阻塞
+inline size_t printAvailable() {
+    return SIZE_MAX;
+}
+
+// 时钟。默认为系统的单调时钟；仿真时切换为虚拟时钟，由Medium按事件推进，
+// 使结果可复现，且仿真的速度不受真实时间的限制
+class Clock {
+
+protected:
+    static inline bool is_virtual = false;
+    static inline uint64_t virtual_us = 0;
+
+public:
+    static uint64_t now() {
+        if(is_virtual) {
+            return virtual_us;
+        }
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    // 切换为虚拟时钟，并从start_us开始计时
+    static void useVirtual(uint64_t start_us = 0) {
+        is_virtual = true;
+        virtual_us = start_us;
+    }
+
+    static bool isVirtual() {
+        return is_virtual;
+    }
+
+    // 推进虚拟时钟，不能倒退
+    static void advanceTo(uint64_t us) {
+        if(us > virtual_us) {
+            virtual_us = us;
+        }
+    }
+
+};
+
+// 与Arduino一致，micros()约71分钟回绕一次
+inline uint32_t micros() {
+    return (uint32_t)Clock::now();
+}
+
+inline uint32_t millis() {
+    return (uint32_t)(Clock::now() / 1000);
+}
+
+// 周期计数器，主机上以1us为一个周期
+inline uint32_t cycleCount() {
+    return (uint32_t)Clock::now();
+}
+
+inline uint32_t cpuFreqMHz() {
+    return 1;
+}
+
+// 随机数
+inline void randomBytes(uint8_t* buffer, size_t len) {
+    for(size_t i = 0; i < len; i++) {
+        buffer[i] = (uint8_t)rand();
+    }
+}
+
+// 文件系统，映射到本地目录。同一进程中的多个节点应各用一个根目录
+class FileSystem {
+
+protected:
+    std::string root;
+
+public:
+    FileSystem(): root("./") {}
+
+    void setRoot(const char* dir) {
+        root = dir;
+        if(root.empty() || root.back() != '/') {
+            root += '/';
+        }
+    }
+
+    bool exists(const char* path) {
+        return access(fullPath(path).c_str(), F_OK) == 0;
+    }
+
+    bool remove(const char* path) {
+        return unlink(fullPath(path).c_str()) == 0;
+    }
+
+    // 读取至多len字节，返回读到的字节数，打开失败返回-1
+    int read(const char* path, void* buffer, size_t len) {
+        FILE* file = fopen(fullPath(path).c_str(), "rb");
+        if(!file) {
+            return -1;
+        }
+        size_t nread = fread(buffer, 1, len, file);
+        fclose(file);
+        return nread;
+    }
+
+    // 覆盖写入len字节，返回写入的字节数，打开失败返回-1
+    int write(const char* path, const void* data, size_t len) {
+        FILE* file = fopen(fullPath(path).c_str(), "wb");
+        if(!file) {
+            return -1;
+        }
+        size_t nwrite = fwrite(data, 1, len, file);
+        fclose(file);
+        return nwrite;
+    }
+
+    bool readString(const char* path, String& content) {
+        FILE* file = fopen(fullPath(path).c_str(), "rb");
+        if(!file) {
+            return false;
+        }
+        std::string str;
+        char buffer[256];
+        size_t nread;
+        while((nread = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            str.append(buffer, nread);
+        }
+        fclose(file);
+        content = String(str);
+        return true;
+    }
+
+protected:
+    std::string fullPath(const char* path) const {
+        return root + path;
+    }
+
+};
+
+// 配置，以json对象的形式存放在文件中。主机上没有ArduinoJson，这里只支持扁平的对象，
+// 值为字符串或数字（以及true/false/null，均按原文保存），这也是config.json实际的格式
+class Config {
+
+protected:
+    String fpath;
+    // 值为字符串的，原样保存；否则保存其原文，并记下不是字符串
+    std::map<std::string, std::pair<std::string, bool>> values;
+
+public:
+    bool load(FileSystem& fs, const String& fpath) {
+        this->fpath = fpath;
+        String content;
+        if(!fs.readString(fpath.c_str(), content)) {
+            RCB_LOGW("failed to open <%s> to read...\n", fpath.c_str());
+            return false;
+        }
+        if(!parse(content.c_str())) {
+            RCB_LOGW("failed to parse <%s> as json...\n", fpath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool save(FileSystem& fs) {
+        std::string content("{");
+        for(auto& kv: values) {
+            if(content.length() > 1) {
+                content += ',';
+            }
+            appendString(content, kv.first);
+            content += ':';
+            if(kv.second.second) {
+                appendString(content, kv.second.first);
+            }
+            else {
+                content += kv.second.first;
+            }
+        }
+        content += '}';
+        if(fs.write(fpath.c_str(), content.data(), content.length()) != (int)content.length()) {
+            RCB_LOGW("failed to open <%s> to write...\n", fpath.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // 读取字符串配置项，不存在或不是字符串时返回空串
+    String get(const char* key) const {
+        auto it = values.find(key);
+        if(it == values.end() || !it->second.second) {
+            return String();
+        }
+        return String(it->second.first);
+    }
+
+    // 读取整数配置项，数字和字符串两种形式都支持，不存在或为空时返回默认值
+    long getInt(const char* key, long default_value) const {
+        auto it = values.find(key);
+        if(it == values.end() || it->second.first.empty()) {
+            return default_value;
+        }
+        return atol(it->second.first.c_str());
+    }
+
+    void set(const String& key, const String& value) {
+        values[key.c_str()] = std::make_pair(std::string(value.c_str()), true);
+    }
+
+    // 遍历所有配置项，f(const char* key, const char* value)，非字符串的值视为空串
+    template <typename F>
+    void forEach(F f) const {
+        for(auto& kv: values) {
+            f(kv.first.c_str(), kv.second.second ? kv.second.first.c_str() : "");
+        }
+    }
+
+protected:
+    bool parse(const char* p) {
+        values.clear();
+        p = skipSpace(p);
+        if(*p++ != '{') {
+            return false;
+        }
+        p = skipSpace(p);
+        if(*p == '}') {
+            return true;
+        }
+        while(true) {
+            std::string key, value;
+            bool is_string;
+            p = parseString(skipSpace(p), key);
+            if(p == nullptr) {
+                return false;
+            }
+            p = skipSpace(p);
+            if(*p++ != ':') {
+                return false;
+            }
+            p = skipSpace(p);
+            is_string = *p == '"';
+            if(is_string) {
+                p = parseString(p, value);
+                if(p == nullptr) {
+                    return false;
+                }
+            }
+            else {
+                const char* begin = p;
+                while(*p && *p != ',' && *p != '}' && !isspace((unsigned char)*p)) {
+                    p++;
+                }
+                if(p == begin) {
+                    return false;
+                }
+                value.assign(begin, p);
+            }
+            values[key] = std::make_pair(value, is_string);
+            p = skipSpace(p);
+            if(*p == '}') {
+                return true;
+            }
+            if(*p++ != ',') {
+                return false;
+            }
+        }
+    }
+
+    static const char* skipSpace(const char* p) {
+        while(isspace((unsigned char)*p)) {
+            p++;
+        }
+        return p;
+    }
+
+    // 解析带引号的字符串，返回其后的位置，出错返回nullptr。\u转义按原文保留
+    static const char* parseString(const char* p, std::string& str) {
+        if(*p++ != '"') {
+            return nullptr;
+        }
+        while(*p != '"') {
+            if(*p == 0) {
+                return nullptr;
+            }
+            if(*p == '\\') {
+                p++;
+                switch(*p) {
+                    case 'n': str += '\n'; break;
+                    case 't': str += '\t'; break;
+                    case 'r': str += '\r'; break;
+                    case 'b': str += '\b'; break;
+                    case 'f': str += '\f'; break;
+                    case 'u': str += "\\u"; break;
+                    case 0: return nullptr;
+                    default: str += *p; break;
+                }
+                p++;
+            }
+            else {
+                str += *(p++);
+            }
+        }
+        return p + 1;
+    }
+
+    static void appendString(std::string& content, const std::string& str) {
+        content += '"';
+        for(char c: str) {
+            switch(c) {
+                case '"': content += "\\\""; break;
+                case '\\': content += "\\\\"; break;
+                case '\n': content += "\\n"; break;
+                case '\t': content += "\\t"; break;
+                case '\r': content += "\\r"; break;
+                default: content += c; break;
+            }
+        }
+        content += '"';
+    }
+
+};
+
+// Web服务的替身：主机上没有WiFi热点和网络服务，只记录处理函数，
+// 测试代码可以用request()直接调用处理函数并取得其回复
+class WebServer {
+
+protected:
+    std::map<std::string, std::function<void()>> handlers;
+    std::function<void()> not_found;
+    String current_uri;
+    std::vector<std::pair<String, String>> current_args;
+    String response;
+
+public:
+    bool begin(const String& /*name*/, const char* /*password*/, const char* /*ip_addr*/) {
+        return true;
+    }
+
+    static String macAddress() {
+        return String("02:00:00:00:00:00");
+    }
+
+    void on(const char* uri, std::function<void()> handler) {
+        handlers[uri] = handler;
+    }
+
+    void onNotFound(std::function<void()> handler) {
+        not_found = handler;
+    }
+
+    void handleClient() {}
+
+    // 以给定的参数访问uri，返回回复的内容
+    String request(const char* uri, const std::vector<std::pair<String, String>>& args = {}) {
+        current_uri = uri;
+        current_args = args;
+        response = String();
+        auto it = handlers.find(uri);
+        if(it != handlers.end()) {
+            it->second();
+        }
+        else if(not_found) {
+            not_found();
+        }
+        return response;
+    }
+
+    const String& uri() const {
+        return current_uri;
+    }
+
+    int args() const {
+        return current_args.size();
+    }
+
+    String argName(int i) const {
+        return current_args[i].first;
+    }
+
+    String arg(int i) const {
+        return current_args[i].second;
+    }
+
+    String arg(const char* name) const {
+        for(auto& kv: current_args) {
+            if(kv.first == name) {
+                return kv.second;
+            }
+        }
+        return String();
+    }
+
+    void send(int /*code*/, const char* /*content_type*/, const String& content) {
+        response = content;
+    }
+
+};
+
+// 串口，用于分集接收的两个接收端之间的有线链路。connect()把本端的发送接到另一端的接收，
+// 按100000波特率8E2（每字节120us）的速度在时钟上排定每个字节的到达时刻
+class SerialPort {
+
+public:
+    static constexpr uint32_t BYTE_US = 120;
+    // 发送FIFO的大小，与ESP8266的UART相同
+    static constexpr size_t TX_FIFO_SIZE = 128;
+
+protected:
+    SerialPort* peer;
+    // 已发出、按到达时刻排列的字节
+    std::deque<std::pair<uint64_t, uint8_t>> rx;
+
+public:
+    SerialPort(): peer(nullptr) {}
+
+    SerialPort(const SerialPort&) = delete;
+
+    void connect(SerialPort& other) {
+        peer = &other;
+    }
+
+    bool begin(bool /*rx*/, bool /*tx*/) {
+        return true;
+    }
+
+    // 读取一个已到达的字节，没有则返回-1
+    int read() {
+        if(rx.empty() || rx.front().first > Clock::now()) {
+            return -1;
+        }
+        uint8_t byte = rx.front().second;
+        rx.pop_front();
+        return byte;
+    }
+
+    // 发送FIFO中的空余字节数，即尚未到达对端的字节以外的部分
+    size_t availableForWrite() const {
+        if(peer == nullptr) {
+            return TX_FIFO_SIZE;
+        }
+        size_t pending = 0;
+        uint64_t now = Clock::now();
+        for(auto it = peer->rx.rbegin(); it != peer->rx.rend() && it->first > now; ++it) {
+            pending++;
+        }
+        return pending >= TX_FIFO_SIZE ? 0 : TX_FIFO_SIZE - pending;
+    }
+
+    size_t write(const uint8_t* data, size_t len) {
+        if(peer == nullptr) {
+            return len;
+        }
+        uint64_t time = Clock::now();
+        if(!peer->rx.empty() && peer->rx.back().first > time) {
+            time = peer->rx.back().first;
+        }
+        for(size_t i = 0; i < len; i++) {
+            time += BYTE_US;
+            peer->rx.emplace_back(time, data[i]);
+        }
+        return len;
+    }
+
+};
+
+// 无线收发事件的处理者
+class RadioHandler {
+
+public:
+    // 发送完成，status为0表示对端已确认（广播则仅表示已发出）
+    virtual void onSent(uint8_t* addr, uint8_t status) = 0;
+
+    virtual void onReceived(uint8_t* addr, uint8_t* data, uint8_t len) = 0;
+
+};
+
+}
+
+}
+
+#include "hal-posix-medium.hpp"
@@ -0,0 +1,17 @@
+#pragma once
+
+// 硬件抽象层：无线（esp-now收发与回调、设置信道）、文件系统、配置、时钟、串口、Web服务。
+// 在ESP8266上直接使用SDK与Arduino库；在其它平台（如Linux）上使用POSIX实现，
+// 使协议代码无需修改即可在主机上编译、测试和跑基准
+#if defined(ARDUINO_ARCH_ESP8266)
+#define RCB_HAL_ESP8266 1
+#define RCB_HAL_POSIX 0
+#include "hal-esp8266.hpp"
+#else
+#define RCB_HAL_ESP8266 0
+#define RCB_HAL_POSIX 1
+#include "hal-posix.hpp"
+#endif
+
+// HAL中的日志调用需要logPrint的定义
+#include "log.hpp"
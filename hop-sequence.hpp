@@ -0,0 +1,121 @@
+#pragma once
+
+#include "hal.hpp"
+
+namespace RCBridge {
+
+// 由配对密钥导出的伪随机跳频序列（FHSS）及其时隙时钟。
+// 两端用相同的密钥得到相同的信道排列，每个时隙固定长度，时隙结束时跳到序列中的下一个信道，
+// 不需要逐次握手。发送端的时钟为准，接收端根据发送端在每个时隙开头发出的同步帧校准自己的时钟
+class HopSequence {
+
+public:
+    static constexpr uint8_t MAX_LENGTH = 16;
+
+protected:
+    uint8_t channels[MAX_LENGTH];
+    uint8_t length;
+    // 时隙长度（us）
+    uint32_t slot_us;
+    // 当前时隙在序列中的下标，以及其开始时刻（us）
+    uint8_t index;
+    uint32_t slot_start;
+
+public:
+    HopSequence(): length(0), slot_us(0), index(0), slot_start(0) {}
+
+    // 用密钥作种子，对[min_channel, max_channel]中的信道做Fisher-Yates洗牌
+    void build(const uint8_t* key, size_t len, uint8_t min_channel, uint8_t max_channel) {
+        // FNV-1a散列作为xorshift32的种子
+        uint32_t state = 2166136261u;
+        for(size_t i = 0; i < len; i++) {
+            state = (state ^ key[i]) * 16777619u;
+        }
+        if(state == 0) {
+            state = 1;
+        }
+        length = 0;
+        for(uint8_t ch = min_channel; ch <= max_channel && length < MAX_LENGTH; ch++) {
+            channels[length++] = ch;
+        }
+        for(uint8_t i = length - 1; i > 0; i--) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            uint8_t j = state % (i + 1);
+            uint8_t tmp = channels[i];
+            channels[i] = channels[j];
+            channels[j] = tmp;
+        }
+    }
+
+    uint8_t size() const {
+        return length;
+    }
+
+    uint8_t at(uint8_t i) const {
+        return channels[i % length];
+    }
+
+    // 开始时隙时钟，从下标index的时隙开始
+    void start(uint32_t slot_us, uint8_t index, uint32_t now) {
+        this->slot_us = slot_us;
+        this->index = index % length;
+        slot_start = now;
+    }
+
+    // 按收到的同步信息校准：对端处于下标index的时隙，已经过了offset_us。
+    // 同步帧只会因排队和重传而晚到，所以已锁定（locked）时，推算出的时隙起点比当前的早则直接采用，
+    // 比当前的晚则只跟进1/8，以免重传造成的延迟逐时隙累积
+    void sync(uint8_t index, uint32_t offset_us, uint32_t now, bool locked) {
+        uint32_t start = now - offset_us;
+        index %= length;
+        if(locked && index == this->index) {
+            int32_t diff = (int32_t)(start - slot_start);
+            if(diff > 0) {
+                start = slot_start + diff / 8;
+            }
+        }
+        this->index = index;
+        slot_start = start;
+    }
+
+    // 当前时隙剩余的时间（us），已经结束则为0
+    uint32_t remaining(uint32_t now) const {
+        uint32_t elapsed = now - slot_start;
+        return elapsed >= slot_us ? 0 : slot_us - elapsed;
+    }
+
+    // 当前时隙是否已经结束
+    bool expired(uint32_t now) const {
+        return now - slot_start >= slot_us;
+    }
+
+    // 进入now所在的时隙，跳过其间错过的时隙，返回新的信道
+    uint8_t advance(uint32_t now) {
+        uint32_t nslot = (now - slot_start) / slot_us;
+        slot_start += nslot * slot_us;
+        index = (index + nslot) % length;
+        return channels[index];
+    }
+
+    uint8_t currentIndex() const {
+        return index;
+    }
+
+    uint8_t channel() const {
+        return channels[index];
+    }
+
+    // 当前时隙已经过的时间（us）
+    uint32_t offset(uint32_t now) const {
+        return now - slot_start;
+    }
+
+    uint32_t slotLength() const {
+        return slot_us;
+    }
+
+};
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "hal.hpp"
+
+namespace RCBridge {
+
+// 接收端根据数据帧的滚动序号和发送端时间戳统计链路质量：丢帧、重复、乱序以及到达抖动
+class LinkStats {
+
+public:
+    // 用于判断重复和乱序的窗口大小，比最新序号旧WINDOW帧以上的帧视为发送端重启，重新同步
+    static constexpr uint8_t WINDOW = 32;
+    // 抖动直方图的桶数，第0个桶为<64us，第i个桶为[2^(i+5), 2^(i+6))us，最后一个桶不设上限
+    static constexpr uint8_t NUM_BUCKETS = 12;
+
+public:
+    // 收到的帧数（含重复）、丢失的帧数（序号跳过的，迟到后会扣回）、重复帧数、乱序（迟到）帧数、重新同步次数
+    uint32_t nreceived;
+    uint32_t nlost;
+    uint32_t nduplicate;
+    uint32_t nreorder;
+    uint32_t nresync;
+    // RFC 3550定义的平滑到达抖动，单位us
+    uint32_t jitter;
+    // 相邻两帧传输时延之差的绝对值（即到达间隔减去发送间隔）的直方图
+    uint32_t jitter_hist[NUM_BUCKETS];
+
+protected:
+    // 最新的序号
+    uint16_t last_seq;
+    // 第i位表示序号last_seq-i是否已收到，为0表示尚未收到过任何帧
+    uint32_t window;
+    // 最新一帧的传输时延（接收时刻-发送时刻，两端时钟不同步，只有差值有意义）
+    uint32_t last_transit;
+
+public:
+    LinkStats() {
+        clear();
+    }
+
+    void clear() {
+        nreceived = 0;
+        nlost = 0;
+        nduplicate = 0;
+        nreorder = 0;
+        nresync = 0;
+        jitter = 0;
+        memset(jitter_hist, 0, sizeof(jitter_hist));
+        last_seq = 0;
+        window = 0;
+        last_transit = 0;
+    }
+
+    // 每收到一帧调用一次，sent_us为发送端时间戳，received_us为本地接收时刻，重复帧返回false
+    bool update(uint16_t seq, uint32_t sent_us, uint32_t received_us) {
+        uint32_t transit = received_us - sent_us;
+        nreceived++;
+        int16_t diff = (int16_t)(seq - last_seq);
+        if(window == 0 || diff <= -(int16_t)WINDOW) {
+            if(window != 0) {
+                nresync++;
+            }
+            // 比第一帧更早的序号一律视为重复
+            last_seq = seq;
+            window = ~0u;
+            last_transit = transit;
+            return true;
+        }
+        if(diff > 0) {
+            nlost += diff - 1;
+            window = diff >= WINDOW ? 1 : (window << diff) | 1;
+            last_seq = seq;
+            // 只对按序到达的相邻帧计算抖动：D = (Rj - Ri) - (Sj - Si)
+            int32_t d = (int32_t)(transit - last_transit);
+            uint32_t abs_d = d < 0 ? -d : d;
+            last_transit = transit;
+            jitter += ((int32_t)abs_d - (int32_t)jitter) / 16;
+            jitter_hist[bucketOf(abs_d)]++;
+            return true;
+        }
+        uint32_t mask = 1u << -diff;
+        if(window & mask) {
+            nduplicate++;
+            return false;
+        }
+        // 迟到的帧之前已被计为丢失，扣回
+        window |= mask;
+        nreorder++;
+        nlost--;
+        return true;
+    }
+
+    // 丢帧率，即丢失的帧数/(丢失的帧数+收到的不重复帧数)
+    float lossRate() const {
+        uint32_t total = nlost + nreceived - nduplicate;
+        return total == 0 ? 0.0f : (float)nlost / total;
+    }
+
+    // 转化为多行的人类可读形式
+    String toString() const {
+        char buffer[96];
+        snprintf(buffer, sizeof(buffer),
+            "received = %u, lost = %u (%.2f%%), duplicate = %u, reorder = %u, resync = %u\n",
+            nreceived, nlost, lossRate() * 100, nduplicate, nreorder, nresync);
+        String str(buffer);
+        snprintf(buffer, sizeof(buffer), "jitter = %uus, histogram:\n", jitter);
+        str.concat(buffer);
+        for(uint8_t i = 0; i < NUM_BUCKETS; i++) {
+            if(i + 1 < NUM_BUCKETS) {
+                snprintf(buffer, sizeof(buffer), "\t<%uus: %u\n", 64u << i, jitter_hist[i]);
+            }
+            else {
+                snprintf(buffer, sizeof(buffer), "\t>=%uus: %u\n", 32u << i, jitter_hist[i]);
+            }
+            str.concat(buffer);
+        }
+        return str;
+    }
+
+protected:
+    static uint8_t bucketOf(uint32_t us) {
+        us >>= 6;
+        if(us == 0) {
+            return 0;
+        }
+        uint8_t bucket = 32 - __builtin_clz(us);
+        return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+    }
+
+};
+
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// 分级的日志。编译时由RCB_LOG_LEVEL决定输出到哪一级，更低的级别展开为空语句，参数也不会被求值，
+// 所以热路径（如每帧的收发）中的RCB_LOGD()在默认配置下没有任何开销。可在include之前定义：
+//     #define RCB_LOG_LEVEL RCB_LOG_DEBUG
+#define RCB_LOG_NONE    0
+#define RCB_LOG_ERROR   1
+#define RCB_LOG_WARN    2
+#define RCB_LOG_INFO    3
+#define RCB_LOG_DEBUG   4
+
+#ifndef RCB_LOG_LEVEL
+#define RCB_LOG_LEVEL RCB_LOG_INFO
+#endif
+
+// 出错，功能无法继续（如启动失败）
+#if RCB_LOG_LEVEL >= RCB_LOG_ERROR
+#define RCB_LOGE(...) ::RCBridge::logPrint(__VA_ARGS__)
+#else
+#define RCB_LOGE(...) ((void)0)
+#endif
+
+// 可以恢复的异常（如单帧发送失败）
+#if RCB_LOG_LEVEL >= RCB_LOG_WARN
+#define RCB_LOGW(...) ::RCBridge::logPrint(__VA_ARGS__)
+#else
+#define RCB_LOGW(...) ((void)0)
+#endif
+
+// 状态变化（如初始化、配对、链路中断与恢复）
+#if RCB_LOG_LEVEL >= RCB_LOG_INFO
+#define RCB_LOGI(...) ::RCBridge::logPrint(__VA_ARGS__)
+#else
+#define RCB_LOGI(...) ((void)0)
+#endif
+
+// 调试细节（如每帧的内容、每次跳频）
+#if RCB_LOG_LEVEL >= RCB_LOG_DEBUG
+#define RCB_LOGD(...) ::RCBridge::logPrint(__VA_ARGS__)
+#else
+#define RCB_LOGD(...) ((void)0)
+#endif
+
+namespace RCBridge {
+
+// 定义在log.hpp中。HAL的实现也要分级输出，而log.hpp依赖HAL的串口，所以单独声明在这里
+template <typename... T>
+void logPrint(const char* format, T... args);
+
+}
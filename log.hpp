@@ -0,0 +1,119 @@
+#pragma once
+
+#include "log-level.hpp"
+#include "hal.hpp"
+
+namespace RCBridge {
+
+// 延迟输出的日志缓冲。WiFi回调中同步写串口会阻塞协议栈（115200波特率下每100字节约9ms），
+// 所以回调中的日志只格式化后写入该环形缓冲，由loop()调用flush()在串口不阻塞的前提下逐步输出。
+// 缓冲满时丢弃整条日志并计数，下次输出时提示
+class LogBuffer {
+
+public:
+    static constexpr size_t SIZE = 1024;
+    // 单条日志的最大长度，超出的部分被截断
+    static constexpr size_t MAX_LINE = 128;
+
+protected:
+    char buffer[SIZE];
+    // 写入和读出的位置，都单调递增，对SIZE取模得到下标
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    // 嵌套的延迟区间数，大于0时日志写入缓冲
+    uint8_t depth;
+
+public:
+    // 统计：因缓冲满而丢弃的日志条数（输出提示后清零）
+    volatile uint32_t ndrop;
+
+public:
+    LogBuffer(): head(0), tail(0), depth(0), ndrop(0) {}
+
+    bool deferred() const {
+        return depth > 0;
+    }
+
+    void enter() {
+        depth++;
+    }
+
+    void leave() {
+        depth--;
+    }
+
+    template <typename... T>
+    void write(const char* format, T... args) {
+        char line[MAX_LINE];
+        int len = snprintf(line, sizeof(line), format, args...);
+        if(len <= 0) {
+            return;
+        }
+        if((size_t)len >= sizeof(line)) {
+            len = sizeof(line) - 1;
+        }
+        if(SIZE - (head - tail) < (size_t)len) {
+            ndrop++;
+            return;
+        }
+        for(int i = 0; i < len; i++) {
+            buffer[(head + i) % SIZE] = line[i];
+        }
+        head += len;
+    }
+
+    // 输出缓冲中的日志，至多HAL::printAvailable()字节，以免阻塞loop()
+    void flush() {
+        size_t room = HAL::printAvailable();
+        if(ndrop != 0 && room >= 32) {
+            HAL::print("[%u log lines dropped]\n", ndrop);
+            ndrop = 0;
+            room -= 32;
+        }
+        while(tail != head && room > 0) {
+            size_t start = tail % SIZE;
+            size_t len = head - tail;
+            // 回绕时分两段输出
+            if(len > SIZE - start) {
+                len = SIZE - start;
+            }
+            if(len > room) {
+                len = room;
+            }
+            HAL::print("%.*s", (int)len, buffer + start);
+            tail += len;
+            room -= len;
+        }
+    }
+
+};
+
+inline LogBuffer log_buffer;
+
+// 在作用域内把日志写入延迟缓冲，用于WiFi回调等不能阻塞的上下文
+class LogDefer {
+
+public:
+    LogDefer() {
+        log_buffer.enter();
+    }
+
+    ~LogDefer() {
+        log_buffer.leave();
+    }
+
+};
+
+template <typename... T>
+void logPrint(const char* format, T... args) {
+    if(log_buffer.deferred()) {
+        log_buffer.write(format, args...);
+    }
+    else {
+        // 先输出之前延迟的日志，尽量保持先后顺序
+        log_buffer.flush();
+        HAL::print(format, args...);
+    }
+}
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "hal.hpp"
+
+namespace RCBridge {
+
+// 发送端根据最近若干次发送的结果（onSent()的status）估计丢帧，决定何时跳频。
+// 用一个32位的位图记录最近的结果（第i位为1表示倒数第i+1次发送丢失），丢帧数由popcount得到，
+// 只有整数运算，可以放在WiFi回调中。
+// 短窗口（最近8次）反应快，信道突然失效时几帧内即触发；长窗口（最近32次）反映缓慢恶化的信道，
+// 二者都不会因为零星的丢帧而触发。触发后进入劣化状态，长窗口的丢帧数降到恢复阈值以下才退出（迟滞），
+// 劣化期间每隔holdoff次发送才会再次触发，避免连续发出跳频命令
+class LossWindow {
+
+public:
+    static constexpr uint8_t SHORT_WINDOW = 8;
+    static constexpr uint8_t LONG_WINDOW = 32;
+
+protected:
+    // 触发阈值：短窗口、长窗口中的丢帧数达到该值即触发
+    uint8_t short_trigger;
+    uint8_t long_trigger;
+    // 恢复阈值：长窗口中的丢帧数不超过该值即退出劣化状态
+    uint8_t long_recover;
+    // 劣化期间两次触发之间至少间隔的发送次数
+    uint8_t holdoff;
+    // 最近LONG_WINDOW次发送的结果
+    uint32_t history;
+    // 已记录的结果数，至多LONG_WINDOW
+    uint8_t count;
+    // 上次触发以来的发送次数，至多255
+    uint8_t since_trigger;
+    bool degraded;
+
+public:
+    // 统计：触发的次数
+    uint32_t ntrigger;
+
+public:
+    LossWindow(uint8_t short_trigger = 5, uint8_t long_trigger = 8, uint8_t long_recover = 2, uint8_t holdoff = 16):
+        short_trigger(short_trigger), long_trigger(long_trigger), long_recover(long_recover), holdoff(holdoff) {
+        clear();
+        ntrigger = 0;
+    }
+
+    // 清空历史，比如换到新信道后，旧信道上的丢帧不再有参考意义
+    void clear() {
+        history = 0;
+        count = 0;
+        since_trigger = 255;
+        degraded = false;
+    }
+
+    // 每次发送完成时调用，lost表示对端未确认，返回true表示应当跳频
+    bool update(bool lost) {
+        history = (history << 1) | (lost ? 1 : 0);
+        if(count < LONG_WINDOW) {
+            count++;
+        }
+        if(since_trigger < 255) {
+            since_trigger++;
+        }
+        uint8_t nshort = shortLosses();
+        uint8_t nlong = longLosses();
+        if(degraded && nlong <= long_recover && nshort == 0) {
+            degraded = false;
+        }
+        if(nshort < short_trigger && nlong < long_trigger) {
+            return false;
+        }
+        if(degraded && since_trigger < holdoff) {
+            return false;
+        }
+        degraded = true;
+        since_trigger = 0;
+        ntrigger++;
+        return true;
+    }
+
+    // 上一次发送是否丢失
+    bool lastLost() const {
+        return (history & 1) != 0;
+    }
+
+    uint8_t shortLosses() const {
+        return __builtin_popcount(history & ((1u << SHORT_WINDOW) - 1));
+    }
+
+    uint8_t longLosses() const {
+        return __builtin_popcount(history);
+    }
+
+    // 长窗口的丢帧率，单位‰
+    uint16_t lossPermille() const {
+        return count == 0 ? 0 : (uint16_t)(longLosses() * 1000u / count);
+    }
+
+    bool isDegraded() const {
+        return degraded;
+    }
+
+};
+
+}
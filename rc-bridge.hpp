@@ -1,34 +1,53 @@
 #pragma once
 
-#include <espnow.h>
-#include <LittleFS.h>
-#include <ArduinoJson.h>
-#include <ESP8266WiFi.h>
-#include <ESP8266WebServer.h>
+#include "hal.hpp"
+#include "log.hpp"
+#include "sbus.hpp"
+#include "frame-queue.hpp"
+#include "link-stats.hpp"
+#include "loss-window.hpp"
+#include "channel-table.hpp"
+#include "hop-sequence.hpp"
+#include "replay-window.hpp"
+#include "diversity.hpp"
+#include "channel-codec.hpp"
+#include "fec.hpp"
 
 namespace RCBridge {
 
-template <typename... T>
-void debug(const char* format, T... args) {
-    Serial.printf(format, args...);
-}
-
-class RCBridgeBase {
+class RCBridgeBase: public HAL::RadioHandler {
 
 protected:
     // 默认名称（SSID）前缀
-    static constexpr char* DEFAULT_NAME_PREFIX = "RCBridge-";
+    static constexpr const char* DEFAULT_NAME_PREFIX = "RCBridge-";
     // IP地址
-    static constexpr char* IP_ADDR = "192.168.1.1";
+    static constexpr const char* IP_ADDR = "192.168.1.1";
     // 首页文件名、 配置文件名
-    static constexpr char* FNAME_HTML = "index.html";
-    static constexpr char* FNAME_JSON = "config.json";
+    static constexpr const char* FNAME_HTML = "index.html";
+    static constexpr const char* FNAME_JSON = "config.json";
     // 该文件存放6字节MAC地址+16字节随机密钥的对端信息
-    static constexpr char* FPATH_PEER = "peer.info";
+    static constexpr const char* FPATH_PEER = "peer.info";
+    // 该文件缓存链路状态：1字节的当前信道，接收端另有各信道1字节的质量评分。
+    // 重启（比如掉电）后直接在该信道上开始，不用再扫描寻找对端
+    static constexpr const char* FPATH_LINK = "link.info";
+    // 信道变化后至少间隔该时间（ms）才写一次链路缓存，以免频繁跳频时磨损闪存
+    static constexpr uint32_t LINK_SAVE_MS = 30000;
+    // 该文件存放防重放计数的状态：4字节的发送计数预留上限，4字节的接收计数下限，均为小端
+    static constexpr const char* FPATH_REPLAY = "replay.info";
+    // 防重放计数每次预留的数量，发送计数用到预留上限前一半时才写一次文件，500Hz下约4分钟一次；
+    // 重启后从预留上限继续计数，所以对端不会把新帧当作重放
+    static constexpr uint32_t REPLAY_BLOCK = 1 << 17;
+    // 防重放模式下，配对后的帧末尾附加的发送计数的字节数
+    static constexpr uint8_t REPLAY_SIZE = 4;
     // 最小、最大以及初始化信道
     static constexpr uint8_t MIN_CHANNEL = 1;
     static constexpr uint8_t MAX_CHANNEL = 13;
     static constexpr uint8_t INIT_CHANNEL = 7;
+    // 配对搜索：发送端从INIT_CHANNEL开始逐信道广播搜索命令，每个信道停留SEARCH_DWELL_MS等待回复；
+    // 接收端每个信道监听SEARCH_LISTEN_MS，至少是发送端扫描一轮（13*10ms）的两倍，
+    // 所以发送端连续扫描时，接收端的每段监听中必有完整的一轮，被干扰的信道只会让配对推迟一段监听
+    static constexpr uint32_t SEARCH_DWELL_MS = 10;
+    static constexpr uint32_t SEARCH_LISTEN_MS = 300;
     // 发送端未配对时广播发送1字节的搜索命令
     static constexpr uint8_t CMD_SEARCH = 1;
     // 接收端收到搜索命令时的回复，格式：{RPL_SEARCH, <16字节的密钥>}，共1+16字节
@@ -37,20 +56,73 @@ protected:
     static constexpr uint8_t CMD_HOP = 3;
     // 接收端回复跳频命令，格式：{RPL_HOP, <1字节的新信道>}，2字节
     static constexpr uint8_t RPL_HOP = 4;
-    // 发送端单向推送数据帧，格式：{CMD_DATA，<字节数>，<数据>...}，共1+1+n字节
+    // 发送端单向推送数据帧，格式：{CMD_DATA, <数据>...}，共1+n字节
     static constexpr uint8_t CMD_DATA = 5;
+    // 发送端单向推送带序号的数据帧，格式：{CMD_DATA_SEQ, <2字节滚动序号>, <4字节发送时刻（us）>, <数据>...}，
+    // 整数均为小端，共1+2+4+n字节，接收端据此统计丢帧、重复、乱序和抖动
+    static constexpr uint8_t CMD_DATA_SEQ = 6;
+    static constexpr uint8_t DATA_SEQ_HEADER_SIZE = 1 + 2 + 4;
+    // 跳频序列模式下，发送端在每个时隙开头发送的同步帧，
+    // 格式：{CMD_SYNC, <1字节时隙下标>, <4字节时隙内已过的时间（us）>}，整数为小端，共6字节
+    static constexpr uint8_t CMD_SYNC = 7;
+    static constexpr uint8_t SYNC_SIZE = 1 + 1 + 4;
+    // 发送端在链路恢复扫描中逐信道发送的1字节探测帧，对端确认即说明找到了接收端
+    static constexpr uint8_t CMD_PROBE = 8;
+    // 接收端在数据帧之间的空闲中回传给发送端的遥测数据，格式：{CMD_TELEMETRY, <数据>...}，共1+n字节
+    static constexpr uint8_t CMD_TELEMETRY = 9;
+    // 冗余模式下发送端隔一小段时间重发的带序号的数据帧，格式同CMD_DATA_SEQ，接收端按序号去重
+    static constexpr uint8_t CMD_DATA_REPEAT = 10;
+    // 前向纠错模式下发送端每K个带序号的数据帧之后发出的校验帧，格式见FecEncoder
+    static constexpr uint8_t CMD_PARITY = 11;
+    // 跳频序列模式的默认时隙长度（ms）
+    static constexpr uint32_t DEFAULT_FHSS_SLOT_MS = 50;
+    // 跳频序列模式下，时隙结束前留出的余量（us），用于确认帧和两端跳频时刻的偏差
+    static constexpr uint32_t FHSS_GUARD_US = 500;
 
 protected:
     // HTML页面文件
     String fpath_html;
     // 存放配置的json文件
     String fpath_json;
-    // 存放配置的json对象
-    DynamicJsonDocument json;
+    // 配置
+    HAL::Config config;
     // Web服务以供配置
-    ESP8266WebServer web;
-    // 是否已配对
+    HAL::WebServer web;
+    // 文件系统
+    HAL::FileSystem fs;
+    // 无线
+    HAL::Radio radio;
+    // 是否已找到对端（由收发回调设置）
     bool matched;
+    // 是否已完成配对，即对端信息已保存并加入esp-now，此后才收发数据。
+    // 配对是由loop()推进的状态机：未找到对端时执行一步搜索，找到后完成配对并调用onPaired()
+    bool paired;
+    // 是否按由密钥导出的跳频序列定时跳频（配置项fhss非0，两端须一致），否则仅在信号差时通过握手跳频
+    bool fhss;
+    // 跳频序列及其时隙时钟，时隙长度由配置项fhss.slot（ms）决定
+    HopSequence hop_sequence;
+    // 开始配对（begin()）的时刻（ms）
+    uint32_t pair_start;
+    // 链路缓存中的信道，以及上次写入的时刻（ms）
+    uint8_t saved_channel;
+    uint32_t saved_ms;
+    // 是否防重放（配置项replay非0，两端须一致）：配对后每帧末尾附加本方单调递增的计数（小端），
+    // 对端用滑动窗口拒绝重复或过旧的计数，使截获的加密帧无法被重放（比如强制跳频或注入旧的摇杆位置）
+    bool replay;
+    // 上一帧用掉的发送计数，以及已写入文件的预留上限
+    uint32_t tx_counter;
+    uint32_t tx_limit;
+    // 对端计数的滑动窗口，以及已写入文件的接收下限
+    ReplayWindow replay_window;
+    uint32_t rx_floor;
+
+public:
+    // 统计：从begin()到完成配对的耗时（ms），已有配对文件时约为0
+    uint32_t pair_ms;
+    // 统计：因重放检查而被丢弃的帧数
+    uint32_t nreplay;
+
+protected:
     // 对端信息
     struct {
         // 对端MAC地址
@@ -85,50 +157,32 @@ protected:
     } peer;
 
 protected:
-    RCBridgeBase(): json(8) {}
+    RCBridgeBase() {}
+
+    // len字节的esp-now帧以1Mbps发送时的空口时间（us），含前导码和MAC帧头，不含确认和重传
+    static constexpr uint32_t airTime(uint8_t len) {
+        return 192 + (43 + len) * 8;
+    }
 
     bool begin(const char* dir) {
         fpath_html = dir;
         fpath_html.concat(FNAME_HTML);
         fpath_json = dir;
         fpath_json.concat(FNAME_JSON);
-        File file = LittleFS.open(fpath_json, "r");
-        if(!file) {
-            debug("failed to open <%s> to read......\n", fpath_json.c_str());
-            return false;
-        }
-        size_t fsize = file.size();
-        json = DynamicJsonDocument(fsize * 2);
-        auto err = deserializeJson(json, file);
-        file.close();
-        if(err) {
-            debug("failed to parse <%s> as json...\n", fpath_json.c_str());
+        if(!config.load(fs, fpath_json)) {
             return false;
         }
-        debug("configuration loaded from <%s>...\n", fpath_json.c_str());
+        RCB_LOGI("configuration loaded from <%s>...\n", fpath_json.c_str());
         // 配置文件中需要有name和password字段，否则使用默认值
-        String name = json["name"];
-        const char* password = json["password"];
+        String name = config.get("name");
+        String password = config.get("password");
         if(name.isEmpty()) {
             name = DEFAULT_NAME_PREFIX;
-            name.concat(WiFi.softAPmacAddress());
-        }
-        if(!WiFi.mode(WIFI_AP)) {
-            debug("failed to switch to AP mode...\n");
-            return false;
-        }
-        if(!WiFi.softAP(name, password)) {
-            debug("failed to setup WiFi access point...\n");
-            return false;
+            name.concat(web.macAddress());
         }
-        debug("WiFi access point <%s> setup...\n", name.c_str());
-        IPAddress ip;
-        ip.fromString(IP_ADDR);
-        if(!WiFi.softAPConfig(ip, ip, IPAddress(255, 255, 255, 0))) {
-            debug("failed to set IP to <%s>...\n", IP_ADDR);
+        if(!web.begin(name, password.isEmpty() ? nullptr : password.c_str(), IP_ADDR)) {
             return false;
         }
-        web.begin();
         web.onNotFound([&]() {
             String message("找不到页面（");
             message.concat(web.uri());
@@ -136,7 +190,7 @@ protected:
             sendMessage(message.c_str());
         });
         web.on("/", [&]() {
-            sendWebPage(fpath_html, json);
+            sendWebPage(fpath_html);
         });
         web.on("/reset", [&]() {
             if(reset()) {
@@ -155,108 +209,133 @@ protected:
             if(!onConfigUpdating()) {
                 return;
             }
-            debug("configuration updated as:\n>>>\n");
+            RCB_LOGD("configuration updated as:\n>>>\n");
             int narg = web.args();
             for(int i = 0; i < narg; i++) {
                 const String& key = web.argName(i);
                 const String& value = web.arg(i);
-                debug("\t<%s> = <%s>\n", key.c_str(), value.c_str());
-                json[key] = value;
-            }
-            debug("<<<\n");
-            File file = LittleFS.open(fpath_json, "w");
-            if(file) {
-                serializeJson(json, file);
-                file.close();
+                RCB_LOGD("\t<%s> = <%s>\n", key.c_str(), value.c_str());
+                config.set(key, value);
+            }
+            RCB_LOGD("<<<\n");
+            if(config.save(fs)) {
                 sendMessage("配置已更新，重启以应用新配置...");
             }
             else {
-                debug("failed to open <%s> to write...\n", fpath_json.c_str());
                 sendMessage("保存配置出错！");
             }
         });
-        debug("web service started on <%s:80>...\n", IP_ADDR);
+        RCB_LOGI("web service started on <%s:80>...\n", IP_ADDR);
         matched = false;
-        json["peer.addr"] = "N/A";
-        // espnow本质就是802.11的帧，所以设置wifi信道就是设置espnow的信道
-        if(!wifi_set_channel(INIT_CHANNEL)) {
-            debug("failed to set channel to %d...\n", INIT_CHANNEL);
-            return false;
-        }
-        if(esp_now_init() != 0) {
-            debug("failed to initialize esp-now...\n");
+        paired = false;
+        pair_start = HAL::millis();
+        pair_ms = 0;
+        replay = config.getInt("replay", 0) != 0;
+        tx_counter = 0;
+        tx_limit = 0;
+        rx_floor = 0;
+        replay_window.clear();
+        nreplay = 0;
+        config.set("peer.addr", "N/A");
+        if(!radio.setChannel(INIT_CHANNEL)) {
+            RCB_LOGW("failed to set channel to %d...\n", INIT_CHANNEL);
             return false;
         }
-        if(esp_now_set_self_role(ESP_NOW_ROLE_COMBO) != 0) {
-            debug("failed to set esp-now role as combo...\n");
+        if(!onRadioStarting()) {
             return false;
         }
-        // espnow的回调函数无法带user defined argument，只能通过全局变量转入成员方法中，
-        // 不过好在不管是发送端还是接收端都是全局单例的
-        static RCBridgeBase* instance = this;
-        int ret = esp_now_register_send_cb([](uint8_t* addr, uint8_t status) {
-            instance->onSent(addr, status);
-        });
-        if(ret != 0) {
-            debug("failed to register send callback...\n");
-            return false;
-        }
-        ret = esp_now_register_recv_cb([](uint8_t* addr, uint8_t* data, uint8_t len) {
-            instance->onReceived(addr, data, len);
-        });
-        if(ret != 0) {
-            debug("failed to register receive callback...\n");
+        if(!radio.begin(this)) {
             return false;
         }
-        // 如果有配对文件，直接读取
-        if(LittleFS.exists(FPATH_PEER)) {
-            File file = LittleFS.open(FPATH_PEER, "r");
-            if(!file) {
-                debug("failed to open <%s> to read...\n", FPATH_PEER);
+        // 如果有配对文件，直接读取，否则由loop()现场搜索对端
+        if(fs.exists(FPATH_PEER)) {
+            int nread = fs.read(FPATH_PEER, &peer, sizeof(peer));
+            if(nread < 0) {
+                RCB_LOGE("failed to open <%s> to read...\n", FPATH_PEER);
                 return false;
             }
-            size_t nread = file.readBytes((char*)&peer, sizeof(peer));
-            file.close();
             if(nread != sizeof(peer)) {
-                debug("failed to read from <%s>...\n", FPATH_PEER);
+                RCB_LOGE("failed to read from <%s>...\n", FPATH_PEER);
                 return false;
             }
-            debug("peer <%s> loaded from <%s>...\n", peer.toString().c_str(), FPATH_PEER);
+            RCB_LOGI("peer <%s> loaded from <%s>...\n", peer.toString().c_str(), FPATH_PEER);
+            matched = true;
+            loadLink();
         }
-        // 否则现场搜索对端，并将MAC地址保存入文件
         else {
-            if(!searchForPeer()) {
-                debug("failed to search for peer...\n");
-                return false;
+            RCB_LOGI("searching for peer...\n");
+        }
+        saved_channel = radio.getChannel();
+        saved_ms = HAL::millis();
+        return true;
+    }
+
+    // 推进配对状态机，不阻塞，返回是否已完成配对
+    bool pollPairing() {
+        if(paired) {
+            return true;
+        }
+        if(!matched) {
+            searchStep();
+            return false;
+        }
+        // 现场搜索到的对端，将其信息保存入文件
+        if(!fs.exists(FPATH_PEER)) {
+            int nwrite = fs.write(FPATH_PEER, &peer, sizeof(peer));
+            if(nwrite < 0) {
+                RCB_LOGE("failed to open <%s> to write...\n", FPATH_PEER);
             }
-            File file = LittleFS.open(FPATH_PEER, "w");
-            if(!file) {
-                debug("failed to open <%s> to write...\n", FPATH_PEER);
-                return false;
+            else if(nwrite != sizeof(peer)) {
+                RCB_LOGE("failed to write to <%s>...\n", FPATH_PEER);
             }
-            size_t nwrite = file.write((uint8_t*)&peer, sizeof(peer));
-            file.close();
-            if(nwrite != sizeof(peer)) {
-                debug("failed to write to <%s>...\n", FPATH_PEER);
-                return false;
+            else {
+                RCB_LOGI("peer <%s> saved to <%s>...\n", peer.toString().c_str(), FPATH_PEER);
+            }
+            saveLink();
+            // 新的对端从0开始计数
+            if(fs.exists(FPATH_REPLAY) && !fs.remove(FPATH_REPLAY)) {
+                RCB_LOGW("failed to remove <%s>...\n", FPATH_REPLAY);
             }
-            debug("peer <%s> saved to <%s>...\n", peer.toString().c_str(), FPATH_PEER);
         }
-        if(esp_now_add_peer(peer.addr, ESP_NOW_ROLE_COMBO, 0, peer.key, sizeof(peer.key)) != 0) {
-            debug("failed to add <%s> as esp-now combo...\n", peer.toString().c_str());
+        if(replay) {
+            loadReplay();
+        }
+        if(!radio.addPeer(peer.addr, peer.key, sizeof(peer.key))) {
+            // 重新搜索
+            RCB_LOGE("failed to add <%s> as esp-now combo...\n", peer.toString().c_str());
+            matched = false;
             return false;
         }
-        matched = true;
-        json["peer.addr"] = peer.toString(true);
+        paired = true;
+        pair_ms = HAL::millis() - pair_start;
+        RCB_LOGI("paired in %ums...\n", pair_ms);
+        config.set("peer.addr", peer.toString(true));
+        onPaired();
         return true;
     }
 
 public:
+    bool isPaired() const {
+        return paired;
+    }
+
     // 删除已配对的信息，使得下次begin()会重新搜索配对
     bool reset() {
-        if(LittleFS.exists(FPATH_PEER)) {
-            if(!LittleFS.remove(FPATH_PEER)) {
-                debug("failed to remove <%s>...\n", FPATH_PEER);
+        if(fs.exists(FPATH_PEER)) {
+            if(!fs.remove(FPATH_PEER)) {
+                RCB_LOGW("failed to remove <%s>...\n", FPATH_PEER);
+                return false;
+            }
+        }
+        if(fs.exists(FPATH_LINK)) {
+            if(!fs.remove(FPATH_LINK)) {
+                RCB_LOGW("failed to remove <%s>...\n", FPATH_LINK);
+                return false;
+            }
+        }
+        if(fs.exists(FPATH_REPLAY)) {
+            if(!fs.remove(FPATH_REPLAY)) {
+                RCB_LOGW("failed to remove <%s>...\n", FPATH_REPLAY);
                 return false;
             }
         }
@@ -264,50 +343,191 @@ public:
     }
 
 protected:
-    // 发送<fpath>指向的html文件，用json中的字段填充html中的${xxx}字段
-    bool sendWebPage(const String& fpath, JsonDocument& json) {
-        File file = LittleFS.open(fpath, "r");
-        if(!file) {
-            debug("failed to open <%s> to read...", fpath.c_str());
+    // 读取链路缓存，切换到其中的信道，其余部分交给onLinkLoaded()
+    bool loadLink() {
+        uint8_t link[1 + ChannelTable::NUM_CHANNELS];
+        int nread = fs.read(FPATH_LINK, link, sizeof(link));
+        if(nread < 1 || link[0] < MIN_CHANNEL || link[0] > MAX_CHANNEL) {
+            return false;
+        }
+        if(!radio.setChannel(link[0])) {
+            RCB_LOGW("failed to set channel to %d...\n", link[0]);
+            return false;
+        }
+        RCB_LOGI("channel %d loaded from <%s>...\n", link[0], FPATH_LINK);
+        onLinkLoaded(link + 1, nread - 1);
+        return true;
+    }
+
+    // 把当前信道和linkState()写入链路缓存
+    bool saveLink() {
+        uint8_t link[1 + ChannelTable::NUM_CHANNELS];
+        link[0] = radio.getChannel();
+        int len = 1 + linkState(link + 1);
+        saved_channel = link[0];
+        saved_ms = HAL::millis();
+        if(fs.write(FPATH_LINK, link, len) != len) {
+            RCB_LOGW("failed to write to <%s>...\n", FPATH_LINK);
+            return false;
+        }
+        return true;
+    }
+
+    // 在loop()中调用：信道与缓存不同且距上次写入已超过LINK_SAVE_MS时更新缓存，
+    // 跳频序列模式下信道一直在变，不缓存
+    void pollLink() {
+        if(!fhss && radio.getChannel() != saved_channel && HAL::millis() - saved_ms >= LINK_SAVE_MS) {
+            saveLink();
+        }
+    }
+
+    // 读取防重放计数的状态，并立即预留下一段发送计数
+    void loadReplay() {
+        uint8_t state[8];
+        if(fs.read(FPATH_REPLAY, state, sizeof(state)) == sizeof(state)) {
+            tx_limit = state[0] | state[1] << 8 | state[2] << 16 | (uint32_t)state[3] << 24;
+            rx_floor = state[4] | state[5] << 8 | state[6] << 16 | (uint32_t)state[7] << 24;
+        }
+        else {
+            tx_limit = 0;
+            rx_floor = 0;
+        }
+        tx_counter = tx_limit;
+        replay_window.clear(rx_floor);
+        saveReplay();
+        RCB_LOGI("replay counters loaded, tx = %u, rx floor = %u...\n", tx_counter, rx_floor);
+    }
+
+    // 预留下一段发送计数，并把接收下限推进到窗口之前，写入文件
+    bool saveReplay() {
+        tx_limit = tx_counter + REPLAY_BLOCK;
+        uint32_t top = replay_window.top();
+        if(top > ReplayWindow::SIZE && top - ReplayWindow::SIZE > rx_floor) {
+            rx_floor = top - ReplayWindow::SIZE;
+        }
+        uint8_t state[8];
+        for(uint8_t i = 0; i < 4; i++) {
+            state[i] = (uint8_t)(tx_limit >> (i * 8));
+            state[4 + i] = (uint8_t)(rx_floor >> (i * 8));
+        }
+        if(fs.write(FPATH_REPLAY, state, sizeof(state)) != sizeof(state)) {
+            RCB_LOGW("failed to write to <%s>...\n", FPATH_REPLAY);
+            return false;
+        }
+        return true;
+    }
+
+    // 在loop()中调用：发送计数用掉预留的一半，或对端计数超过接收下限一整段时写文件，
+    // WiFi回调中不写闪存
+    void pollReplay() {
+        if(replay && (tx_limit - tx_counter < REPLAY_BLOCK / 2 || replay_window.top() - rx_floor >= REPLAY_BLOCK)) {
+            saveReplay();
+        }
+    }
+
+    // 在frame的前len字节之后附加发送计数，返回附加后的长度，frame须留有REPLAY_SIZE字节的余量
+    uint8_t seal(uint8_t* frame, uint8_t len) {
+        if(!replay) {
+            return len;
+        }
+        uint32_t counter = ++tx_counter;
+        for(uint8_t i = 0; i < REPLAY_SIZE; i++) {
+            frame[len + i] = (uint8_t)(counter >> (i * 8));
+        }
+        return len + REPLAY_SIZE;
+    }
+
+    // 检查并去掉frame末尾的发送计数，重放或过旧的帧返回false
+    bool unseal(const uint8_t* frame, uint8_t& len) {
+        if(!replay) {
+            return true;
+        }
+        if(len < 1 + REPLAY_SIZE) {
+            nreplay++;
+            return false;
+        }
+        len -= REPLAY_SIZE;
+        const uint8_t* tail = frame + len;
+        uint32_t counter = tail[0] | tail[1] << 8 | tail[2] << 16 | (uint32_t)tail[3] << 24;
+        if(!replay_window.check(counter)) {
+            nreplay++;
+            return false;
+        }
+        return true;
+    }
+
+    // 子类可重载以在链路缓存中附加状态，写入data，返回字节数，至多ChannelTable::NUM_CHANNELS
+    virtual uint8_t linkState(uint8_t* /*data*/) {
+        return 0;
+    }
+
+    // 子类可重载以恢复linkState()附加的状态
+    virtual void onLinkLoaded(const uint8_t* /*data*/, uint8_t /*len*/) {}
+
+protected:
+    // 发送<fpath>指向的html文件，用配置中的字段填充html中的${xxx}字段；
+    // 如果给出了message，则只用它填充${message}字段
+    bool sendWebPage(const String& fpath, const char* message = nullptr) {
+        String content;
+        if(!fs.readString(fpath.c_str(), content)) {
+            RCB_LOGW("failed to open <%s> to read...", fpath.c_str());
             web.send(500, "text/plain", "server internal error...");
             return false;
         }
-        String content = file.readString();
-        file.close();
-        String key;
-        for(auto kv: json.as<JsonObject>()) {
-            key = "${";
-            key.concat(kv.key().c_str());
-            key.concat('}');
-            const char* value = kv.value().as<const char*>();
-            content.replace(key, value);
-        }
-        debug("page <%s> rendered:\n>>>\n%s\n<<<\n", fpath.c_str(), content.c_str());
+        if(message == nullptr) {
+            String key;
+            config.forEach([&](const char* name, const char* value) {
+                key = "${";
+                key.concat(name);
+                key.concat('}');
+                content.replace(key, value);
+            });
+        }
+        else {
+            content.replace("${message}", message);
+        }
+        RCB_LOGD("page <%s> rendered:\n>>>\n%s\n<<<\n", fpath.c_str(), content.c_str());
         web.send(200, "text/html", content);
         return true;
     }
 
     // 套用message.html，显示简单消息
     bool sendMessage(const char* message) {
-        size_t capacity = (7 + strlen(message)) * 2;
-        if(capacity < 256) {
-            StaticJsonDocument<256> json;
-            json["message"] = message;
-            return sendWebPage("message.html", json);
-        }
-        else {
-            DynamicJsonDocument json(capacity);
-            json["message"] = message;
-            return sendWebPage("message.html", json);
-        }
+        return sendWebPage("message.html", message);
     }
 
 protected:
-    virtual bool searchForPeer() = 0;
+    // 未找到对端时由loop()反复调用，执行一步搜索，不能阻塞
+    virtual void searchStep() = 0;
+
+    // 配对完成时调用一次
+    virtual void onPaired() {}
+
+    // 启动无线之前调用，此时配置已读取，子类可重载以修改无线的设置（如MAC地址）或预置配对文件
+    virtual bool onRadioStarting() {
+        return true;
+    }
+
+    // 把十六进制字符串（字节之间可以有冒号）解析为恰好len字节
+    static bool parseHex(const String& str, uint8_t* out, size_t len) {
+        const char* p = str.c_str();
+        for(size_t i = 0; i < len; i++) {
+            if(i > 0 && *p == ':') {
+                p++;
+            }
+            unsigned int byte;
+            if(!isxdigit((unsigned char)p[0]) || !isxdigit((unsigned char)p[1]) || sscanf(p, "%2x", &byte) != 1) {
+                return false;
+            }
+            out[i] = (uint8_t)byte;
+            p += 2;
+        }
+        return *p == 0;
+    }
 
-    virtual void onSent(uint8_t* addr, uint8_t status) = 0;
+    virtual void onSent(uint8_t* addr, uint8_t status) override = 0;
 
-    virtual void onReceived(uint8_t* addr, uint8_t* data, uint8_t len) = 0;
+    virtual void onReceived(uint8_t* addr, uint8_t* data, uint8_t len) override = 0;
 
     // 用户可重载该方法以监听访问/update的事件，比如可以检查web传来的参数，
     // 返回false可以中断配置生效
@@ -321,123 +541,580 @@ protected:
 class BasicSender: public RCBridgeBase {
 
 protected:
-    // 指数平滑移动均值中新值的权重
-    static constexpr float quality_weight = 0.01f;
-    // 信号质量降至此阈值触发跳频命令
-    static constexpr float hop_threshold = 0.75f;
+    // 发送队列的槽位数
+    static constexpr size_t TX_QUEUE_CAPACITY = 4;
+    // 遥测接收队列的槽位数
+    static constexpr size_t TELEMETRY_QUEUE_CAPACITY = 4;
+    // 交给无线的帧超过该时间（us）仍未回调onSent()，则认为回调丢失，继续发送队列中的帧
+    static constexpr uint32_t TX_TIMEOUT_US = 100000;
+    // 连续发送失败这么多次，说明两端已不在同一信道（比如跳频回复的确认丢失），进入恢复扫描
+    static constexpr uint8_t RECOVERY_FAILURES = 10;
+    // 未配对时搜索命令的广播计划：启动后先连续扫描SEARCH_BURST轮，对端在场时通常几十毫秒内即可配对；
+    // 之后每轮之间的间歇从SEARCH_GAP_MIN_MS起逐轮加倍，直至SEARCH_GAP_MAX_MS，以免长期占用信道
+    static constexpr uint8_t SEARCH_BURST = 4;
+    static constexpr uint32_t SEARCH_GAP_MIN_MS = 100;
+    static constexpr uint32_t SEARCH_GAP_MAX_MS = 2000;
 
 protected:
-    // 当前信号质量
-    float radio_quality;
+    // 根据最近的发送结果估计丢帧，决定何时跳频
+    LossWindow loss_window;
+    // 是否在数据帧中带上序号和时间戳（配置项data.seq非0），即发送CMD_DATA_SEQ而非CMD_DATA
+    bool sequenced;
+    // 下一帧的序号
+    uint16_t tx_seq;
+    // 上一帧未完成时，send()把整帧（含帧头）放入该队列，由onSent()逐帧发出，发出时才在槽位中附加防重放计数，
+    // 这样任何时刻只有一帧在无线中，发送速率自动匹配信道的实际容量
+    FrameQueue<250, TX_QUEUE_CAPACITY> tx_queue;
+    // 是否合并待发送的帧（配置项tx.coalesce非0），即队列中只保留最新的一帧，适合只关心最新值的数据（如遥控通道）
+    bool coalesce;
+    // 是否有已交给无线、尚未回调onSent()的帧，以及交出的时刻（us）
+    bool tx_busy;
+    uint32_t tx_time;
+    // 连续发送失败的次数
+    uint8_t nfail_run;
+    // 是否在恢复扫描中，以及开始的时刻（ms）。扫描时暂停发送数据，每个信道发一个探测帧，
+    // 失败（含重传约10ms）即换下一个信道，一轮不超过150ms
+    bool recovering;
+    uint32_t recover_start;
+    // 接收回调只把遥测帧的数据拷入该队列，由loop()取出后调用onTelemetry()
+    FrameQueue<250, TELEMETRY_QUEUE_CAPACITY> telemetry_queue;
+    // 冗余模式（配置项tx.repeat非0）下每个数据帧提交后隔多久（us）再发一份CMD_DATA_REPEAT，
+    // 错开突发干扰；接收端按序号取先到的一份，所以此时总是带序号发送
+    uint32_t repeat_offset;
+    // 待重发的帧，格式：{<4字节应当发出的时刻（us），小端>, <未附加防重放计数的帧>}，重发时另取计数。
+    // 合并模式下提交新帧时，旧帧的重发作废，以免接收端在新值之后又收到旧值
+    FrameQueue<4 + 250, TX_QUEUE_CAPACITY> repeat_queue;
+    // 在途的是否是带序号的数据帧及其序号，以及最近64个序号中哪些已被确认（第i位对应tx_seq-1-i）。
+    // 已被确认的帧对端必然收到了，它的重发只会占用空口、推迟新帧，不再发出
+    bool tx_data;
+    uint16_t tx_data_seq;
+    uint64_t tx_acked;
+    // 前向纠错（配置项fec为每组的帧数K，0表示关闭）：每发出K个数据帧，在无线空闲时追加一个校验帧，
+    // 接收端可还原组内任意一帧，此时总是带序号发送
+    FecEncoder fec_encoder;
+    uint8_t fec;
+    // 待发出的校验帧（未附加防重放计数），只保留最新的一个
+    bool parity_pending;
+    uint8_t parity_len;
+    uint8_t parity_frame[250];
+
+public:
+    // 统计：因合并而被丢弃的帧数、无线拒绝发送的帧数、onSent()超时的次数
+    uint32_t ncoalesce;
+    uint32_t nsend_fail;
+    uint32_t ntimeout;
+    // 统计：恢复的次数，最近一次和最长的恢复耗时（ms）
+    uint32_t nrecover;
+    uint32_t recover_ms;
+    uint32_t max_recover_ms;
+
+    // 统计：广播搜索命令的次数
+    uint32_t nbeacon;
+    // 统计：冗余模式下发出的重发帧数、作废（合并模式下被新帧取代、重发队列满，或积压过久）的重发帧数
+    uint32_t nrepeat;
+    uint32_t nrepeat_skip;
+    // 统计：前向纠错模式下发出的校验帧数、因下一组先凑齐而作废的校验帧数
+    uint32_t nparity;
+    uint32_t nparity_skip;
+
+protected:
+    // 上次广播搜索命令的时刻（ms），以及到下次广播的间隔（ms）
+    uint32_t last_beacon;
+    uint32_t beacon_interval;
+    // 本轮扫描中下一个信道的序号、已完成的扫描轮数，以及当前每轮之间的间歇（ms）
+    uint8_t search_index;
+    uint32_t nsweep;
+    uint32_t sweep_gap;
 
 public:
     bool begin() {
-        radio_quality = 1.0f;
+        loss_window.clear();
+        tx_seq = 0;
+        tx_queue.clear();
+        telemetry_queue.clear();
+        repeat_queue.clear();
+        tx_data = false;
+        tx_acked = 0;
+        nrepeat = 0;
+        nrepeat_skip = 0;
+        parity_pending = false;
+        nparity = 0;
+        nparity_skip = 0;
+        tx_busy = false;
+        ncoalesce = 0;
+        nsend_fail = 0;
+        ntimeout = 0;
+        nfail_run = 0;
+        recovering = false;
+        nrecover = 0;
+        recover_ms = 0;
+        max_recover_ms = 0;
+        fhss = false;
+        nbeacon = 0;
+        last_beacon = 0;
+        beacon_interval = 0;
+        search_index = 0;
+        nsweep = 0;
+        sweep_gap = 0;
         if(!RCBridgeBase::begin("sender/")) {
             return false;
         }
-        debug("basic sender initialized...\n");
+        sequenced = config.getInt("data.seq", 0) != 0;
+        coalesce = config.getInt("tx.coalesce", 0) != 0;
+        fhss = config.getInt("fhss", 0) != 0;
+        repeat_offset = config.getInt("tx.repeat", 0);
+        fec = config.getInt("fec", 0);
+        if(fec == 1 || fec > FecEncoder::WINDOW) {
+            RCB_LOGW("invalid fec group size %d...\n", fec);
+            fec = 0;
+        }
+        fec_encoder.begin(fec);
+        if(repeat_offset != 0 || fec != 0) {
+            sequenced = true;
+        }
+        RCB_LOGI("basic sender initialized, sequenced = %d, coalesce = %d, fhss = %d, repeat = %uus, fec = %d...\n",
+            sequenced, coalesce, fhss, repeat_offset, fec);
+        // 已有配对文件时立即完成配对
+        pollPairing();
         return true;
     }
 
-    bool send(uint8_t len, const void* data) {
-        // espnow一次最多发送250字节，去除开头一字节的CMD_DATA，用户数据最大249字节
-        if(len > 249) {
-            debug("data more than 249 bytes...\n");
-            return false;
+    // acquire()返回的待发送帧，用户把数据直接写入data()，再交给commit()
+    class Frame {
+
+        friend class BasicSender;
+
+    protected:
+        decltype(tx_queue)::Slot* slot;
+        uint8_t header_size;
+        uint8_t len;
+
+    public:
+        Frame(): slot(nullptr), header_size(0), len(0) {}
+
+        // 是否成功获得了发送队列中的槽位
+        explicit operator bool() const {
+            return slot != nullptr;
         }
-        uint8_t command[250];
-        command[0] = CMD_DATA;
-        memcpy(command + 1, data, len);
-        if(esp_now_send(peer.addr, command, len + 1) != 0) {
-            debug("failed to send data...\n");
+
+        // 用户数据的起始地址，其前面预留了帧头
+        uint8_t* data() const {
+            return slot->data + header_size;
+        }
+
+        uint8_t size() const {
+            return len;
+        }
+
+    };
+
+public:
+    // 发送一帧数据，无线空闲时立即发出，否则放入发送队列。
+    // 队列满时丢弃该帧并返回false；合并模式下则替换队列中尚未发出的帧
+    bool send(uint8_t len, const void* data) {
+        Frame frame = acquire(len);
+        if(!frame) {
             return false;
         }
+        memcpy(frame.data(), data, len);
+        commit(frame);
         return true;
     }
 
+    // 在发送队列中预留一帧len字节的数据，用户直接写入frame.data()后调用commit()，
+    // 省去send()的一次拷贝。commit()之前不能再次调用acquire()或send()。
+    // 队列满时返回的frame为假；合并模式下则替换队列中尚未发出的帧
+    Frame acquire(uint8_t len) {
+        Frame frame;
+        if(!paired) {
+            return frame;
+        }
+        // espnow一次最多发送250字节，去除开头的帧头（和末尾的防重放计数），
+        // 用户数据最大249字节（带序号时为243字节，防重放时再少4字节，前向纠错时校验帧比数据帧长，再少3字节）
+        uint8_t header_size = sequenced ? DATA_SEQ_HEADER_SIZE : 1;
+        uint8_t max_len = 250 - header_size - (replay ? REPLAY_SIZE : 0) -
+            (fec ? FecEncoder::HEADER_SIZE - FecEncoder::SKIP : 0);
+        if(len > max_len) {
+            RCB_LOGW("data more than %d bytes...\n", max_len);
+            return frame;
+        }
+        if(coalesce && tx_queue.size() > 0) {
+            tx_queue.pop();
+            ncoalesce++;
+        }
+        frame.slot = tx_queue.acquire();
+        if(frame.slot == nullptr) {
+            tx_queue.ndrop++;
+            return frame;
+        }
+        frame.header_size = header_size;
+        frame.len = len;
+        return frame;
+    }
+
+    // 填写帧头并发送acquire()预留的帧，无线空闲时立即发出
+    void commit(const Frame& frame) {
+        uint8_t* command = frame.slot->data;
+        if(sequenced) {
+            uint32_t now = HAL::micros();
+            command[0] = CMD_DATA_SEQ;
+            command[1] = (uint8_t)tx_seq;
+            command[2] = (uint8_t)(tx_seq >> 8);
+            command[3] = (uint8_t)now;
+            command[4] = (uint8_t)(now >> 8);
+            command[5] = (uint8_t)(now >> 16);
+            command[6] = (uint8_t)(now >> 24);
+            tx_seq++;
+            tx_acked <<= 1;
+        }
+        else {
+            command[0] = CMD_DATA;
+        }
+        if(repeat_offset != 0) {
+            queueRepeat(command, frame.header_size + frame.len);
+        }
+        // 防重放计数在dispatch()交给无线时才附加，与探测、同步等帧的计数按实际发出的顺序递增
+        frame.slot->len = frame.header_size + frame.len;
+        tx_queue.commit();
+        if(!tx_busy) {
+            dispatch();
+        }
+    }
+
     void loop() {
+        // WiFi回调中的日志延迟到这里输出
+        log_buffer.flush();
+        if(!pollPairing()) {
+            web.handleClient();
+            return;
+        }
+        if(tx_busy && HAL::micros() - tx_time >= TX_TIMEOUT_US) {
+            RCB_LOGW("send completion timed out...\n");
+            ntimeout++;
+            tx_busy = false;
+        }
+        stepHop();
+        if(recovering && !tx_busy) {
+            probe();
+        }
+        // 扫描中的信道不一定能通，不缓存
+        if(!recovering) {
+            pollLink();
+        }
+        pollReplay();
+        // 可能有被留到下一个时隙的帧
+        if(!tx_busy) {
+            dispatch();
+        }
+        while(auto slot = telemetry_queue.front()) {
+            onTelemetry(slot->len, (void*)slot->data);
+            telemetry_queue.pop();
+        }
         web.handleClient();
     }
 
 protected:
-    virtual bool searchForPeer() override {
-        const char* broadcast = "\xff\xff\xff\xff\xff\xff";
-        uint8_t command = CMD_SEARCH;
-        unsigned long last_time = 0;
-        // 广播发送直到配对
-        while(!matched) {
-            unsigned long now = micros();
-            // 每500ms发送一次
-            if(now - last_time >= 500000) {
-                debug("searching for receiver...\n");
-                if(esp_now_send((uint8_t*)broadcast, &command, 1) != 0) {
-                    debug("failed to broadcast beacon...\n");
-                    return false;
-                }
-                last_time = now;
+    // 把一帧交给无线，成功则在onSent()之前不再发送
+    bool transmit(const uint8_t* data, uint8_t len) {
+        tx_data = false;
+        if(!radio.send(peer.addr, data, len)) {
+            nsend_fail++;
+            return false;
+        }
+        tx_busy = true;
+        tx_time = HAL::micros();
+        return true;
+    }
+
+    // 在当前信道上发送探测帧
+    void probe() {
+        uint8_t command[1 + REPLAY_SIZE] = {CMD_PROBE};
+        if(!transmit(command, seal(command, 1))) {
+            RCB_LOGW("failed to send probe...\n");
+        }
+    }
+
+    // 恢复扫描中探测帧完成，成功则留在该信道并恢复发送，否则换下一个信道继续探测
+    void onProbed(uint8_t status) {
+        if(status == 0) {
+            recovering = false;
+            nfail_run = 0;
+            loss_window.clear();
+            nrecover++;
+            recover_ms = HAL::millis() - recover_start;
+            if(recover_ms > max_recover_ms) {
+                max_recover_ms = recover_ms;
             }
-            // 不要让web服务停止响应
-            web.handleClient();
+            RCB_LOGI("link recovered on channel %d in %ums...\n", radio.getChannel(), recover_ms);
+            dispatch();
+            return;
+        }
+        uint8_t channel = radio.getChannel() + 1;
+        if(channel > MAX_CHANNEL) {
+            channel = MIN_CHANNEL;
+        }
+        if(!radio.setChannel(channel)) {
+            RCB_LOGW("failed to set channel to %d...\n", channel);
+        }
+        probe();
+    }
+
+    // 跳频序列模式下，当前时隙结束且没有在途的帧时跳到下一个信道，并发出同步帧，返回是否发出了同步帧
+    bool stepHop() {
+        uint32_t now = HAL::micros();
+        if(!fhss || tx_busy || !hop_sequence.expired(now)) {
+            return false;
+        }
+        uint8_t channel = hop_sequence.advance(now);
+        if(!radio.setChannel(channel)) {
+            RCB_LOGW("failed to set channel to %d...\n", channel);
+        }
+        loss_window.clear();
+        return sendSync();
+    }
+
+    bool sendSync() {
+        uint32_t offset = hop_sequence.offset(HAL::micros());
+        uint8_t command[SYNC_SIZE + REPLAY_SIZE] = {
+            CMD_SYNC, hop_sequence.currentIndex(),
+            (uint8_t)offset, (uint8_t)(offset >> 8), (uint8_t)(offset >> 16), (uint8_t)(offset >> 24),
+        };
+        if(!transmit(command, seal(command, SYNC_SIZE))) {
+            RCB_LOGW("failed to send sync...\n");
+            return false;
         }
         return true;
     }
 
+    // 发出队列中最旧的一帧，无线拒绝发送时丢弃该帧而继续下一帧，以免队列卡住。
+    // 跳频序列模式下，在当前时隙内发不完的帧留到下一个时隙，否则接收端跳走后它的重传全部失败。
+    // 队列空了再发校验帧，再看是否到了重发的时刻，二者都不会推迟新帧
+    void dispatch() {
+        if(recovering) {
+            return;
+        }
+        while(auto* slot = tx_queue.front()) {
+            if(fhss && hop_sequence.remaining(HAL::micros()) < airTime(slot->len + (replay ? REPLAY_SIZE : 0)) + FHSS_GUARD_US) {
+                return;
+            }
+            // 无线拒绝发送的帧也算作组内的帧，接收端可以还原它
+            if(fec && fec_encoder.add(slot->data, slot->len)) {
+                if(parity_pending) {
+                    nparity_skip++;
+                }
+                parity_len = fec_encoder.take(CMD_PARITY, parity_frame);
+                parity_pending = true;
+            }
+            // 防重放计数就地附加在槽位中，acquire()已为它留出余量
+            bool ok = transmit(slot->data, seal(slot->data, slot->len));
+            if(ok && repeat_offset != 0) {
+                tx_data = true;
+                tx_data_seq = slot->data[1] | slot->data[2] << 8;
+            }
+            tx_queue.pop();
+            if(ok) {
+                return;
+            }
+            RCB_LOGW("failed to send data...\n");
+        }
+        uint32_t now = HAL::micros();
+        if(parity_pending) {
+            if(fhss && hop_sequence.remaining(now) < airTime(parity_len + (replay ? REPLAY_SIZE : 0)) + FHSS_GUARD_US) {
+                return;
+            }
+            parity_pending = false;
+            if(transmit(parity_frame, seal(parity_frame, parity_len))) {
+                nparity++;
+                return;
+            }
+            RCB_LOGW("failed to send parity...\n");
+        }
+        while(auto* slot = repeat_queue.front()) {
+            uint32_t due = slot->data[0] | slot->data[1] << 8 | slot->data[2] << 16 | (uint32_t)slot->data[3] << 24;
+            if((int32_t)(now - due) < 0) {
+                return;
+            }
+            // 原帧已被确认时不必重发；信道饱和时重发可能一直排不上，之后发出的帧超过接收端的去重窗口时已无用，都丢弃
+            uint16_t seq = slot->data[4 + 1] | slot->data[4 + 2] << 8;
+            uint16_t age = tx_seq - 1 - seq;
+            if(age >= ReplayWindow::SIZE || (tx_acked & (uint64_t)1 << age)) {
+                repeat_queue.pop();
+                nrepeat_skip++;
+                continue;
+            }
+            uint8_t len = slot->len - 4;
+            if(fhss && hop_sequence.remaining(now) < airTime(len + (replay ? REPLAY_SIZE : 0)) + FHSS_GUARD_US) {
+                return;
+            }
+            uint8_t* command = slot->data + 4;
+            bool ok = transmit(command, seal(command, len));
+            repeat_queue.pop();
+            if(ok) {
+                nrepeat++;
+                return;
+            }
+            RCB_LOGW("failed to send repeat...\n");
+        }
+    }
+
+    // 记下刚提交的帧（未附加防重放计数），repeat_offset之后重发
+    void queueRepeat(const uint8_t* command, uint8_t len) {
+        if(coalesce) {
+            while(repeat_queue.front()) {
+                repeat_queue.pop();
+                nrepeat_skip++;
+            }
+        }
+        auto slot = repeat_queue.acquire();
+        if(slot == nullptr) {
+            nrepeat_skip++;
+            return;
+        }
+        uint32_t due = HAL::micros() + repeat_offset;
+        slot->data[0] = (uint8_t)due;
+        slot->data[1] = (uint8_t)(due >> 8);
+        slot->data[2] = (uint8_t)(due >> 16);
+        slot->data[3] = (uint8_t)(due >> 24);
+        memcpy(slot->data + 4, command, len);
+        slot->data[4] = CMD_DATA_REPEAT;
+        slot->len = 4 + len;
+        repeat_queue.commit();
+    }
+
+protected:
+    // 按广播计划逐信道发送搜索命令
+    virtual void searchStep() override {
+        static const uint8_t broadcast[6] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+        uint32_t now = HAL::millis();
+        if(nbeacon != 0 && now - last_beacon < beacon_interval) {
+            return;
+        }
+        constexpr uint8_t nchannel = MAX_CHANNEL - MIN_CHANNEL + 1;
+        uint8_t channel = MIN_CHANNEL + (INIT_CHANNEL - MIN_CHANNEL + search_index) % nchannel;
+        if(!radio.setChannel(channel)) {
+            RCB_LOGW("failed to set channel to %d...\n", channel);
+        }
+        uint8_t command = CMD_SEARCH;
+        if(!radio.send(broadcast, &command, 1)) {
+            RCB_LOGW("failed to broadcast beacon...\n");
+        }
+        last_beacon = now;
+        nbeacon++;
+        beacon_interval = SEARCH_DWELL_MS;
+        if(++search_index < nchannel) {
+            return;
+        }
+        // 一轮扫描结束
+        search_index = 0;
+        nsweep++;
+        if(nsweep >= SEARCH_BURST) {
+            sweep_gap = sweep_gap == 0 ? SEARCH_GAP_MIN_MS :
+                sweep_gap * 2 < SEARCH_GAP_MAX_MS ? sweep_gap * 2 : SEARCH_GAP_MAX_MS;
+        }
+        beacon_interval += sweep_gap;
+        RCB_LOGD("searching for receiver, %u sweeps done, next in %ums...\n", nsweep, beacon_interval);
+    }
+
+    virtual void onPaired() override {
+        if(fhss) {
+            uint32_t slot_ms = config.getInt("fhss.slot", DEFAULT_FHSS_SLOT_MS);
+            hop_sequence.build(peer.key, sizeof(peer.key), MIN_CHANNEL, MAX_CHANNEL);
+            hop_sequence.start(slot_ms * 1000, 0, HAL::micros());
+            if(!radio.setChannel(hop_sequence.channel())) {
+                RCB_LOGW("failed to set channel to %d...\n", hop_sequence.channel());
+            }
+            sendSync();
+        }
+    }
+
     virtual void onReceived(uint8_t* addr, uint8_t* data, uint8_t len) override {
+        LogDefer defer;
         if(!matched) {
             // 收到搜索回复，格式：{RPL_SEARCH, <密钥>}
             if(len == 1 + sizeof(peer.key) && data[0] == RPL_SEARCH) {
                 memcpy(peer.addr, addr, 6);
                 memcpy(peer.key, data + 1, sizeof(peer.key));
                 matched = true;
-                debug("receiver <%s> matched...\n", peer.toString().c_str());
+                RCB_LOGI("receiver <%s> matched...\n", peer.toString().c_str());
             }
         }
-        else {
+        else if(unseal(data, len)) {
             // 收到跳频回复，格式：{RPL_HOP, <新信道>}
-            if(len == 2 && data[0] == RPL_HOP) {
+            if(!fhss && len == 2 && data[0] == RPL_HOP) {
                 uint8_t channel = data[1];
-                if(wifi_set_channel(channel)) {
-                    debug("channel hopped to %d...\n", channel);
+                if(radio.setChannel(channel)) {
+                    // 旧信道上的丢帧不再有参考意义
+                    loss_window.clear();
+                    RCB_LOGD("channel hopped to %d...\n", channel);
                 }
                 else {
-                    debug("failed to set channel to %d...\n", channel);
+                    RCB_LOGW("failed to set channel to %d...\n", channel);
                 }
             }
+            // 收到遥测帧，放入队列等待loop()处理
+            else if(len >= 1 && data[0] == CMD_TELEMETRY) {
+                telemetry_queue.push(data + 1, len - 1);
+            }
         }
     }
 
     virtual void onSent(uint8_t* addr, uint8_t status) {
+        LogDefer defer;
         if(!matched) {
             // 未配对时发送的是广播，广播包的onSent()仅告知是否发送成功，
             // 而不反馈是否有设备收到且确认（因为广播没有明确的接收者）
             if(status != 0) {
-                debug("failed to broadcast beacon...\n");
+                RCB_LOGW("failed to broadcast beacon...\n");
             }
         }
         else {
-            // 用指数平滑均值法计算当前加权的信号质量，即avg=(1-w)*avg + w*X
-            static constexpr float cw = 1.0f - quality_weight;
+            // 配对时广播的信标可能在配对后才回调，它不占用发送队列
+            if(memcmp(addr, peer.addr, 6) != 0) {
+                return;
+            }
+            tx_busy = false;
+            if(tx_data && status == 0 && (uint16_t)(tx_seq - 1 - tx_data_seq) < 64) {
+                tx_acked |= (uint64_t)1 << (uint16_t)(tx_seq - 1 - tx_data_seq);
+            }
+            if(recovering) {
+                onProbed(status);
+                return;
+            }
+            nfail_run = status == 0 ? 0 : nfail_run + 1;
+            // 跳频序列模式下接收端失步后会自己停在序列中的信道上等待，不用扫描
+            if(!fhss && nfail_run >= RECOVERY_FAILURES) {
+                RCB_LOGI("link lost, scanning for receiver...\n");
+                recovering = true;
+                recover_start = HAL::millis();
+                onProbed(1);
+                return;
+            }
 #ifndef SIMULATE_LOW_RADIO_QUALITY
-            // status == 0代表帧被对端接收，记为1，否则记为0
-            radio_quality = radio_quality * cw + (status == 0) * quality_weight;
+            // status == 0代表帧被对端接收
+            bool hop = loss_window.update(status != 0);
 #else
-            // 在调试阶段，可使用此代码模拟信号质量只有50%，以触发跳频逻辑
-            radio_quality = radio_quality * cw + 0.5f * quality_weight;
+            // 在调试阶段，可使用此代码模拟隔一帧丢一帧，以触发跳频逻辑
+            bool hop = loss_window.update(!loss_window.lastLost());
 #endif
-            if(radio_quality < hop_threshold) {
-                debug("channel hopping triggered...\n");
+            // 跳频序列模式下本来就定时跳频，不用再发起握手
+            if(stepHop()) {
+                return;
+            }
+            if(hop && fhss) {
+                onLowRadioQuality();
+            }
+            else if(hop) {
+                RCB_LOGI("channel hopping triggered...\n");
                 // 用户可继承后实现hook
                 onLowRadioQuality();
-                uint8_t command = CMD_HOP;
-                if(esp_now_send(peer.addr, &command, 1) == 0) {
-                    // 如果不重置radio_quality，那么很可能连续发送多个跳频命令
-                    radio_quality = 1.0f;
-                }
-                else {
-                    debug("failed to send hop command...\n");
+                // 跳频命令优先于队列中的数据帧
+                uint8_t command[1 + REPLAY_SIZE] = {CMD_HOP};
+                if(transmit(command, seal(command, 1))) {
+                    return;
                 }
+                RCB_LOGW("failed to send hop command...\n");
             }
+            dispatch();
         }
     }
 
@@ -445,121 +1122,810 @@ protected:
     // 用户可重载该方法以监听信号差的事件，比如拉响蜂鸣器让用户注意遥控距离
     virtual void onLowRadioQuality() {}
 
+    // 用户可重载以接收接收端回传的遥测数据（见BasicReceiver::sendTelemetry()），在loop()中被调用
+    virtual void onTelemetry(uint8_t len, void* /*data*/) {
+#if RCB_LOG_LEVEL >= RCB_LOG_DEBUG
+        RCB_LOGD("telemetry received, len = %d...\n", len);
+#else
+        (void)len;
+#endif
+    }
+
 };
 
 // 最小发送端，支持Web配置、发现设备、加密接收数据、自动跳频
 class BasicReceiver: public RCBridgeBase {
 
+protected:
+    // 接收队列的槽位数
+    static constexpr size_t RX_QUEUE_CAPACITY = 8;
+    // 搜索回复的确认丢失时重发的次数，发送端可能已经收到回复并停止广播，不会再给出新的机会
+    static constexpr uint8_t REPLY_RETRIES = 5;
+    // 分集接收的角色（配置项diversity）：
+    // 输出端合并本机无线和有线链路两路收到的带序号的数据帧（发送端须开启data.seq），每帧取最先到达的一份；
+    // 中继端用配置项clone.mac冒用输出端的MAC地址，接收发往输出端的帧，协议层面不发送任何帧，
+    // 只把带序号的数据帧经有线链路（UART0，见HAL::SerialPort）转给输出端。
+    // 网卡仍会自动确认收到的单播帧，与输出端的确认同时发出，可能碰撞，使发送端的onSent()状态不可靠（见README）。
+    // 中继端的配对信息来自配置项clone.peer（发送端的MAC地址）和clone.key，均可在输出端的/stats中查到。
+    // 按需跳频时中继端不知道输出端选的新信道，要靠恢复扫描找回发送端，所以最好配合fhss使用
+    static constexpr uint8_t DIVERSITY_NONE = 0;
+    static constexpr uint8_t DIVERSITY_OUTPUT = 1;
+    static constexpr uint8_t DIVERSITY_RELAY = 2;
+    // 待回传的遥测队列的槽位数
+    static constexpr size_t TELEMETRY_QUEUE_CAPACITY = 4;
+    // 默认每秒至多回传的遥测帧数
+    static constexpr uint32_t DEFAULT_TELEMETRY_RATE = 10;
+    // 遥测帧的空口时间之外，到预计的下一个数据帧之前至少还要留出的余量（us），
+    // 容纳两个确认帧（接收回调时上一个数据帧的确认可能还在空口中）、处理延迟和发送间隔的抖动
+    static constexpr uint32_t TELEMETRY_GUARD_US = 1000;
+    // 超过该时间（us）没有收到数据帧时上行空闲，遥测帧不必等待数据帧之间的空闲
+    static constexpr uint32_t TELEMETRY_IDLE_US = 50000;
+    // 交给无线的遥测帧超过该时间（us）仍未回调onSent()，则认为回调丢失
+    static constexpr uint32_t TELEMETRY_TIMEOUT_US = 100000;
+
 protected:
     // 当前信道
     uint8_t channel;
-    // 跳频方向（1表示每次信道+1，-1表示每次信道-1）
-    int8_t channel_direction;
     // 即将跳到的信道
     uint8_t new_channel;
+    // 各信道的质量评分，跳频时选择评分最高的信道
+    ChannelTable channel_table;
+    // 接收回调只把数据帧拷入该队列，由loop()取出后调用onData()，
+    // 这样无论用户在onData()中做多少事，都不会拖慢WiFi协议栈。分集接收的中继端存放的是待转发的整帧
+    FrameQueue<250, RX_QUEUE_CAPACITY> rx_queue;
+    // 根据CMD_DATA_SEQ的序号和时间戳统计的链路质量
+    LinkStats link_stats;
+    // 最后一次收到对端的帧的时刻（us）
+    uint32_t rx_heard;
+    // 跳频序列模式下是否与发送端同步
+    bool fhss_synced;
+    // 失步时在序列中的一个信道上停留，等待发送端经过，停留的信道下标和开始时刻（us）
+    uint8_t dwell_index;
+    uint32_t dwell_start;
+    // 按需跳频模式下是否在恢复扫描中，即超过RX_LOST_US没收到帧后在各信道上轮流停留RECOVERY_DWELL_US，
+    // 停留时间比发送端扫描一轮的时间长，所以发送端必然会扫到这里
+    bool recovering;
+    // 配对时搜索回复的剩余重发次数，以及上次回复是否失败（由searchStep()重发）
+    uint8_t reply_retries;
+    bool reply_failed;
+    // 配对时在当前信道上开始监听的时刻（ms）
+    uint32_t listen_start;
+    // 分集接收的角色，见DIVERSITY_XXX
+    uint8_t diversity;
+    // 分集接收的有线链路，及其分帧
+    HAL::SerialPort link_port;
+    LinkFramer link_framer;
+    // 按序号给带序号的数据帧去重：分集接收的输出端合并两路帧，冗余模式下合并首发和重发的两份
+    DiversityCombiner combiner;
+    // 是否收到过重发帧，即发送端处于冗余模式（配置项tx.repeat），此后丢弃重复的帧
+    bool redundant;
+    // 记下最近的带序号的数据帧，收到校验帧时还原组内丢失的一帧；以及是否收到过校验帧，
+    // 即发送端处于前向纠错模式（配置项fec）
+    FecDecoder fec_decoder;
+    bool fec_seen;
+    // 待回传的遥测帧（含帧头），由sendTelemetry()放入，loop()在数据帧之间的空闲中逐帧发出
+    FrameQueue<250, TELEMETRY_QUEUE_CAPACITY> telemetry_queue;
+    // 回传遥测帧的最小间隔（us），由配置项telemetry.rate（每秒帧数，0表示不回传）决定
+    uint32_t telemetry_interval;
+    // 是否有已交给无线、尚未回调onSent()的遥测帧，以及上次交出的时刻（us）
+    bool telemetry_busy;
+    uint32_t telemetry_time;
+    // 最后一个数据帧到达的时刻（us）、它与前一个数据帧的间隔（us）及其空口时间（us），
+    // 据此估计到下一个数据帧之前的空闲：下一帧在到达前一个空口时间就已开始发送
+    uint32_t data_time;
+    uint32_t data_gap;
+    uint32_t data_air;
+
+public:
+    // 统计：跳频序列模式下收到的同步帧数、失步的次数
+    uint32_t nsync;
+    uint32_t nsync_lost;
+    // 统计：恢复的次数，最近一次和最长的恢复耗时（ms，从最后一次收到帧算起）
+    uint32_t nrecover;
+    uint32_t recover_ms;
+    uint32_t max_recover_ms;
+    // 统计：发出的遥测帧数、其中未被确认的帧数
+    uint32_t ntelemetry;
+    uint32_t ntelemetry_fail;
+    // 统计：冗余模式下首发丢失、由重发帧救回的帧数
+    uint32_t nrescued;
 
 public:
+    BasicReceiver(): channel_table(MIN_CHANNEL, MAX_CHANNEL) {}
+
     bool begin() {
         channel = INIT_CHANNEL;
-        channel_direction = 1;
+        new_channel = INIT_CHANNEL;
+        channel_table.clear();
+        rx_queue.clear();
+        link_stats.clear();
+        web.on("/stats", [&]() {
+            web.send(200, "text/plain", statsString());
+        });
+        nsync = 0;
+        nsync_lost = 0;
+        recovering = false;
+        nrecover = 0;
+        recover_ms = 0;
+        max_recover_ms = 0;
+        reply_retries = 0;
+        reply_failed = false;
+        listen_start = HAL::millis();
+        link_framer.clear();
+        combiner.clear();
+        redundant = false;
+        nrescued = 0;
+        fec_seen = false;
+        fec_decoder.clear();
+        telemetry_queue.clear();
+        telemetry_busy = false;
+        data_time = 0;
+        data_gap = 0;
+        data_air = 0;
+        ntelemetry = 0;
+        ntelemetry_fail = 0;
+        fhss = false;
+        diversity = DIVERSITY_NONE;
         if(!RCBridgeBase::begin("receiver/")) {
             return false;
         }
-        debug("basic receiver initialized...\n");
+        // 可能从链路缓存中恢复了信道
+        channel = radio.getChannel();
+        new_channel = channel;
+        fhss = config.getInt("fhss", 0) != 0;
+        uint32_t telemetry_rate = config.getInt("telemetry.rate", DEFAULT_TELEMETRY_RATE);
+        telemetry_interval = telemetry_rate == 0 ? 0 : 1000000 / telemetry_rate;
+        if(diversity != DIVERSITY_NONE && !link_port.begin(diversity == DIVERSITY_OUTPUT, diversity == DIVERSITY_RELAY)) {
+            RCB_LOGE("failed to start diversity link...\n");
+            return false;
+        }
+        RCB_LOGI("basic receiver initialized, fhss = %d, diversity = %d...\n", fhss, diversity);
+        // 已有配对文件时立即完成配对
+        pollPairing();
         return true;
     }
 
     void loop() {
+        // WiFi回调中的日志延迟到这里输出
+        log_buffer.flush();
+        if(!pollPairing()) {
+            web.handleClient();
+            return;
+        }
+        if(diversity == DIVERSITY_OUTPUT) {
+            int byte;
+            while((byte = link_port.read()) >= 0) {
+                if(link_framer.feed(byte)) {
+                    acceptData(link_framer.frame(), link_framer.length(), true);
+                }
+            }
+        }
+        while(auto slot = rx_queue.front()) {
+            // 链路（100000波特率，每字节120us）跟不上帧率时丢弃，过时的帧转过去也没用，还会阻塞loop()
+            if(diversity == DIVERSITY_RELAY) {
+                if(link_port.availableForWrite() >= (size_t)slot->len + LinkFramer::OVERHEAD) {
+                    uint8_t buffer[LinkFramer::MAX_FRAME + LinkFramer::OVERHEAD];
+                    link_port.write(buffer, LinkFramer::encode(slot->data, slot->len, buffer));
+                    link_framer.nframe++;
+                }
+                else {
+                    link_framer.ndrop++;
+                }
+            }
+            else {
+                onData(slot->len, (void*)slot->data);
+            }
+            rx_queue.pop();
+        }
+        pollTelemetry();
+        if(fhss) {
+            stepHop();
+        }
+        else {
+            checkLink();
+            if(!recovering) {
+                pollLink();
+            }
+        }
+        pollReplay();
         web.handleClient();
     }
 
-protected:
-    virtual bool searchForPeer() override {
-        debug("waiting for sender...\n");
-        while(!matched) {
-            // 接收端被动监听广播直到配对，无需做事
-            // 不要让web服务停止响应
-            web.handleClient();
+    // 链路和接收队列的统计信息，也可以通过访问/stats查看
+    String statsString() {
+        String str = link_stats.toString();
+        char buffer[96];
+        snprintf(buffer, sizeof(buffer), "pairing: paired = %d, time = %ums\n", paired, pair_ms);
+        str.concat(buffer);
+        if(replay) {
+            snprintf(buffer, sizeof(buffer), "replay: counter = %u, rejected = %u\n", replay_window.top(), nreplay);
+            str.concat(buffer);
+        }
+        snprintf(buffer, sizeof(buffer), "rx queue: push = %u, drop = %u, overwrite = %u, max size = %u\n",
+            rx_queue.npush, rx_queue.ndrop, rx_queue.noverwrite, rx_queue.max_size);
+        str.concat(buffer);
+        if(telemetry_interval != 0) {
+            snprintf(buffer, sizeof(buffer), "telemetry: sent = %u, failed = %u, drop = %u, max size = %u\n",
+                ntelemetry, ntelemetry_fail, telemetry_queue.ndrop, telemetry_queue.max_size);
+            str.concat(buffer);
         }
+        if(diversity == DIVERSITY_OUTPUT) {
+            snprintf(buffer, sizeof(buffer), "diversity: radio = %u, link (rescued) = %u, duplicate = %u, link error = %u\n",
+                combiner.nradio, combiner.nlink, combiner.nduplicate, link_framer.nerror);
+            str.concat(buffer);
+            // 供配置中继端：clone.mac为本机地址，clone.peer和clone.key为以下对端信息
+            str.concat("diversity clone: mac = ");
+            str.concat(web.macAddress());
+            str.concat(", peer ");
+            str.concat(peer.toString());
+            str.concat("\n");
+        }
+        else if(diversity == DIVERSITY_RELAY) {
+            snprintf(buffer, sizeof(buffer), "diversity relay: forwarded = %u, dropped = %u\n",
+                link_framer.nframe, link_framer.ndrop);
+            str.concat(buffer);
+        }
+        if(redundant) {
+            snprintf(buffer, sizeof(buffer), "redundancy: rescued = %u, duplicate = %u\n", nrescued, combiner.nduplicate);
+            str.concat(buffer);
+        }
+        if(fec_seen) {
+            snprintf(buffer, sizeof(buffer), "fec: parity = %u, recovered = %u, unrecoverable = %u\n",
+                fec_decoder.nparity, fec_decoder.nrecovered, fec_decoder.nunrecoverable);
+            str.concat(buffer);
+        }
+        if(fhss) {
+            snprintf(buffer, sizeof(buffer), "fhss: synced = %d, channel = %u, sync = %u, sync lost = %u\n",
+                fhss_synced, channel, nsync, nsync_lost);
+            str.concat(buffer);
+        }
+        else {
+            snprintf(buffer, sizeof(buffer), "recovery: recovering = %d, count = %u, last = %ums, max = %ums\n",
+                recovering, nrecover, recover_ms, max_recover_ms);
+            str.concat(buffer);
+            str.concat(channel_table.toString());
+        }
+        return str;
+    }
+
+    // 回传一帧遥测数据（如链路统计、电池电压、飞控经串口送来的遥测）给发送端，由发送端的onTelemetry()接收。
+    // 遥测帧不与上行的数据帧争抢信道：只在预计的下一个数据帧到来之前还有足够的空闲时才发出，
+    // 且间隔不小于telemetry.rate决定的最小间隔，其余时间在队列中等待。
+    // 上行饱和（比如合并模式下连续发送）时遥测帧会一直等待。未配对、不回传或队列满时返回false
+    bool sendTelemetry(uint8_t len, const void* data) {
+        if(!paired || telemetry_interval == 0 || diversity == DIVERSITY_RELAY) {
+            return false;
+        }
+        // 与数据帧相同，去除帧头和防重放计数后最大249字节（防重放时245字节）
+        uint8_t max_len = 250 - 1 - (replay ? REPLAY_SIZE : 0);
+        if(len > max_len) {
+            RCB_LOGW("telemetry more than %d bytes...\n", max_len);
+            return false;
+        }
+        auto slot = telemetry_queue.acquire();
+        if(slot == nullptr) {
+            telemetry_queue.ndrop++;
+            return false;
+        }
+        slot->data[0] = CMD_TELEMETRY;
+        memcpy(slot->data + 1, data, len);
+        slot->len = 1 + len;
+        telemetry_queue.commit();
         return true;
     }
 
+protected:
+    // 在数据帧之间的空闲中发出队列中最旧的遥测帧
+    void pollTelemetry() {
+        uint32_t now = HAL::micros();
+        if(telemetry_busy && now - telemetry_time >= TELEMETRY_TIMEOUT_US) {
+            telemetry_busy = false;
+        }
+        const auto* slot = telemetry_queue.front();
+        if(slot == nullptr || telemetry_busy || (ntelemetry != 0 && now - telemetry_time < telemetry_interval)) {
+            return;
+        }
+        uint8_t len = slot->len + (replay ? REPLAY_SIZE : 0);
+        uint32_t need = airTime(len) + TELEMETRY_GUARD_US;
+        if(fhss) {
+            // 失步时不知道发送端在哪个信道，发了也收不到；时隙内发不完则留到下一个时隙
+            if(!fhss_synced || hop_sequence.remaining(now) < need) {
+                return;
+            }
+        }
+        // 跳频回复的确认与遥测帧的onSent()无法区分，跳频完成之前不发
+        else if(recovering || new_channel != channel) {
+            return;
+        }
+        // 上行空闲，或者按上一个间隔估计，下一个数据帧到来之前还容得下遥测帧
+        uint32_t elapsed = now - data_time;
+        if(elapsed < TELEMETRY_IDLE_US && elapsed + need + data_air > data_gap) {
+            return;
+        }
+        uint8_t frame[250];
+        memcpy(frame, slot->data, slot->len);
+        telemetry_queue.pop();
+        if(!radio.send(peer.addr, frame, seal(frame, slot->len))) {
+            RCB_LOGW("failed to send telemetry...\n");
+            ntelemetry_fail++;
+            return;
+        }
+        telemetry_busy = true;
+        telemetry_time = now;
+        ntelemetry++;
+    }
+
+protected:
+    // 跳频序列模式下跟随发送端的时隙时钟跳频，连续FHSS_LOST_SLOTS个时隙没收到帧则认为失步
+    static constexpr uint32_t FHSS_LOST_SLOTS = 4;
+    // 按需跳频模式下超过该时间（us）没收到帧则进入恢复扫描
+    static constexpr uint32_t RX_LOST_US = 300000;
+    // 恢复扫描中在每个信道上停留的时间（us），至少是发送端扫描一轮（约13*10ms）的3倍
+    static constexpr uint32_t RECOVERY_DWELL_US = 500000;
+
+    void checkLink() {
+        uint32_t now = HAL::micros();
+        if(!recovering) {
+            if(now - rx_heard >= RX_LOST_US) {
+                RCB_LOGI("link lost, waiting on channel %d...\n", channel);
+                recovering = true;
+                dwell_start = now;
+            }
+        }
+        // 先在当前信道上等待，如果该信道被干扰了，再轮流换到其它信道
+        else if(now - dwell_start >= RECOVERY_DWELL_US) {
+            setChannel(channel < MAX_CHANNEL ? channel + 1 : MIN_CHANNEL);
+            dwell_start = now;
+        }
+    }
+
+    void stepHop() {
+        uint32_t now = HAL::micros();
+        uint32_t slot_us = hop_sequence.slotLength();
+        if(fhss_synced) {
+            if(now - rx_heard >= slot_us * FHSS_LOST_SLOTS) {
+                RCB_LOGI("fhss sync lost...\n");
+                fhss_synced = false;
+                nsync_lost++;
+                // 失步可能是发送端重启了，它的序号也随之重新开始
+                combiner.resync();
+                dwell(hop_sequence.currentIndex());
+            }
+            else if(hop_sequence.expired(now)) {
+                setChannel(hop_sequence.advance(now));
+            }
+        }
+        // 发送端每个序列周期经过每个信道一次，停留比一个周期稍长的时间必然能等到它，
+        // 否则（比如该信道被干扰）换序列中的下一个信道
+        else if(now - dwell_start >= slot_us * (hop_sequence.size() + 1)) {
+            dwell(dwell_index + 1);
+        }
+    }
+
+    void dwell(uint8_t index) {
+        dwell_index = index % hop_sequence.size();
+        dwell_start = HAL::micros();
+        setChannel(hop_sequence.at(dwell_index));
+    }
+
+    void setChannel(uint8_t channel) {
+        if(radio.setChannel(channel)) {
+            this->channel = channel;
+        }
+        else {
+            RCB_LOGW("failed to set channel to %d...\n", channel);
+        }
+    }
+
+protected:
+    // 链路缓存中附加各信道的质量评分，使重启后的跳频仍能避开已知的差信道
+    virtual uint8_t linkState(uint8_t* data) override {
+        return channel_table.saveScores(data);
+    }
+
+    virtual void onLinkLoaded(const uint8_t* data, uint8_t len) override {
+        channel_table.loadScores(data, len);
+    }
+
+    // 接收端被动监听广播直到配对，每SEARCH_LISTEN_MS换一个信道，并重发确认丢失的搜索回复
+    virtual void searchStep() override {
+        // 中继端只能预置配对信息
+        if(diversity == DIVERSITY_RELAY) {
+            return;
+        }
+        uint32_t now = HAL::millis();
+        // 回复未完成时留在当前信道，发送端收到回复后也会停在这里
+        if(reply_retries > 0) {
+            if(reply_failed) {
+                reply_failed = false;
+                reply_retries--;
+                sendReply();
+            }
+            listen_start = now;
+            return;
+        }
+        if(now - listen_start >= SEARCH_LISTEN_MS) {
+            setChannel(channel < MAX_CHANNEL ? channel + 1 : MIN_CHANNEL);
+            listen_start = now;
+        }
+    }
+
+    // 回复搜索命令，格式：{RPL_SEARCH, <密钥>}
+    void sendReply() {
+        uint8_t reply[1 + sizeof(peer.key)];
+        reply[0] = RPL_SEARCH;
+        memcpy(reply + 1, peer.key, sizeof(peer.key));
+        if(!radio.send(peer.addr, reply, sizeof(reply))) {
+            RCB_LOGW("failed to reply beacon...\n");
+        }
+    }
+
+    virtual void onPaired() override {
+        if(fhss) {
+            uint32_t slot_ms = config.getInt("fhss.slot", DEFAULT_FHSS_SLOT_MS);
+            hop_sequence.build(peer.key, sizeof(peer.key), MIN_CHANNEL, MAX_CHANNEL);
+            hop_sequence.start(slot_ms * 1000, 0, HAL::micros());
+            fhss_synced = false;
+            dwell(0);
+        }
+        rx_heard = HAL::micros();
+    }
+
     virtual void onReceived(uint8_t* addr, uint8_t* data, uint8_t len) override {
+        LogDefer defer;
         if(!matched) {
             // 收到配对广播
-            if(len == 1 && data[0] == CMD_SEARCH) {
-                debug("received beacon from %s...\n", peer.toString(true).c_str());
+            if(len == 1 && data[0] == CMD_SEARCH && diversity != DIVERSITY_RELAY) {
+                RCB_LOGD("received beacon from %s...\n", peer.toString(true).c_str());
                 memcpy(peer.addr, addr, 6);
                 // 产生随机密钥
-                randomSeed(micros());
-                for(size_t i = 0; i < sizeof(peer.key); i++) {
-                    peer.key[i] = (uint8_t)random(0, 256);
-                }
-                uint8_t reply[1 + sizeof(peer.key)];
-                reply[0] = RPL_SEARCH;
-                memcpy(reply + 1, peer.key, sizeof(peer.key));
-                if(esp_now_send(addr, reply, sizeof(reply)) != 0) {
-                    debug("failed to reply beacon...\n");
-                }
+                HAL::randomBytes(peer.key, sizeof(peer.key));
+                reply_retries = REPLY_RETRIES;
+                reply_failed = false;
+                sendReply();
             }
         }
         else {
+            // 重放的帧不能算作收到了对端的帧
+            if(!unseal(data, len)) {
+                return;
+            }
+            uint32_t now = HAL::micros();
+            if(recovering) {
+                recovering = false;
+                // 放弃未完成的跳频
+                new_channel = channel;
+                nrecover++;
+                // 中断可能是发送端重启了，它的序号也随之重新开始
+                combiner.resync();
+                recover_ms = (now - rx_heard) / 1000;
+                if(recover_ms > max_recover_ms) {
+                    max_recover_ms = recover_ms;
+                }
+                RCB_LOGI("link recovered on channel %d in %ums...\n", channel, recover_ms);
+            }
+            rx_heard = now;
+            // 收到同步帧，校准时隙时钟，此时必然已处于同步帧所在时隙的信道上
+            if(fhss && len == SYNC_SIZE && data[0] == CMD_SYNC) {
+                uint32_t offset = data[2] | data[3] << 8 | data[4] << 16 | (uint32_t)data[5] << 24;
+                // 到达时刻比发出时刻至少晚一个同步帧的空口时间
+                hop_sequence.sync(data[1], offset + airTime(SYNC_SIZE + (replay ? REPLAY_SIZE : 0)), rx_heard, fhss_synced);
+                fhss_synced = true;
+                nsync++;
+            }
             // 收到跳频命令
-            if(len == 1 && data[0] == CMD_HOP) {
-                debug("received hop command...\n");
-                new_channel = channel + channel_direction;
-                // 如果超出MAX_CHANNEL（即本来已经是MAX_CHANNEL），则调头降一级
-                if(new_channel > MAX_CHANNEL) {
-                    new_channel = MAX_CHANNEL - 1;
+            else if(!fhss && len == 1 && data[0] == CMD_HOP && diversity != DIVERSITY_RELAY) {
+                RCB_LOGD("received hop command...\n");
+                // 回复在途时重复的跳频命令不再扣分，但仍选出同一个信道
+                if(new_channel == channel) {
+                    channel_table.onHop(channel);
+                }
+                new_channel = channel_table.best(channel);
+                uint8_t reply[2 + REPLAY_SIZE] = {RPL_HOP, new_channel};
+                if(!radio.send(peer.addr, reply, seal(reply, 2))) {
+                    RCB_LOGW("failed to reply hop...\n");
+                    new_channel = channel;
                 }
-                // 如果低于MIN_CHANNEL（即本来已经是MIN_CHANNEL），则调头升一级
-                else if(new_channel < MIN_CHANNEL) {
-                    new_channel = MIN_CHANNEL + 1;
+            }
+            else if(len >= 1) {
+                // 记下数据帧的到达间隔，供pollTelemetry()估计空闲
+                uint8_t command = data[0];
+                if(command == CMD_DATA || command == CMD_DATA_SEQ || command == CMD_DATA_REPEAT || command == CMD_PARITY) {
+                    data_gap = now - data_time;
+                    data_time = now;
+                    data_air = airTime(len + (replay ? REPLAY_SIZE : 0));
                 }
-                uint8_t reply[2] = {RPL_HOP, new_channel};
-                if(esp_now_send(peer.addr, reply, 2) != 0) {
-                    debug("failed to reply hop...\n");
+                acceptData(data, len, false);
+            }
+        }
+    }
+
+    // 处理数据帧，from_link表示来自分集接收的有线链路（在loop()中），否则来自本机无线（在接收回调中），
+    // recovered表示由校验帧还原，二者都不计入本机信道的质量评分
+    void acceptData(const uint8_t* data, uint8_t len, bool from_link, bool recovered = false) {
+        bool on_air = !from_link && !recovered;
+        // 收到数据帧，放入队列等待loop()处理
+        if(data[0] == CMD_DATA) {
+            // 不带序号的帧无法判重，中继端不转发
+            if(diversity == DIVERSITY_RELAY) {
+                return;
+            }
+            channel_table.onFrame(channel);
+            rx_queue.push(data + 1, len - 1);
+        }
+        // 收到带序号的数据帧（或其重发），去重、统计后同样放入队列
+        else if(len >= DATA_SEQ_HEADER_SIZE && (data[0] == CMD_DATA_SEQ || data[0] == CMD_DATA_REPEAT)) {
+            if(diversity == DIVERSITY_RELAY) {
+                rx_queue.push(data, len);
+                return;
+            }
+            bool repeat = data[0] == CMD_DATA_REPEAT;
+            if(repeat && !redundant) {
+                RCB_LOGI("repeated frame received, redundancy enabled...\n");
+                redundant = true;
+            }
+            uint16_t seq = data[1] | data[2] << 8;
+            // 总是记下序号，以便收到第一个重发帧时就能判重；不需要去重时重复的帧照常交给LinkStats统计，
+            // 但由校验帧还原出的帧不是重复发送的，已收到过时总是丢弃
+            bool first = combiner.accept(seq, from_link, repeat || recovered);
+            if(!first && (diversity == DIVERSITY_OUTPUT || redundant || recovered)) {
+                // 重复的帧仍说明本机信道是通的
+                if(on_air) {
+                    channel_table.onFrame(channel);
+                }
+                return;
+            }
+            if(first && repeat) {
+                nrescued++;
+            }
+            fec_decoder.add(data, len);
+            uint32_t sent = data[3] | data[4] << 8 | data[5] << 16 | (uint32_t)data[6] << 24;
+            uint32_t nlost = link_stats.nlost;
+            link_stats.update(seq, sent, HAL::micros());
+            if(on_air) {
+                if(link_stats.nlost > nlost) {
+                    channel_table.onLoss(channel, link_stats.nlost - nlost);
                 }
+                channel_table.onFrame(channel);
             }
-            // 收到数据帧
-            else if(len >= 1 && data[0] == CMD_DATA) {
-                onData(len - 1, data + 1);
+            rx_queue.push(data + DATA_SEQ_HEADER_SIZE, len - DATA_SEQ_HEADER_SIZE);
+        }
+        // 收到校验帧，还原组内丢失的一帧后按正常的数据帧处理，此时它已比组内其它帧晚到
+        else if(data[0] == CMD_PARITY) {
+            if(diversity == DIVERSITY_RELAY) {
+                rx_queue.push(data, len);
+                return;
+            }
+            if(!fec_seen) {
+                RCB_LOGI("parity frame received, fec enabled...\n");
+                fec_seen = true;
+            }
+            uint8_t frame[250];
+            uint8_t n = fec_decoder.recover(data, len, CMD_DATA_SEQ, frame);
+            if(n >= DATA_SEQ_HEADER_SIZE) {
+                acceptData(frame, n, from_link, true);
             }
         }
     }
 
-    virtual void onSent(uint8_t* addr, uint8_t status) {
+    // 读取分集接收的角色；中继端冒用输出端的MAC地址，没有配对文件时用配置中的对端信息预置
+    virtual bool onRadioStarting() override {
+        diversity = config.getInt("diversity", DIVERSITY_NONE);
+        if(diversity != DIVERSITY_RELAY) {
+            return true;
+        }
+        uint8_t mac[6];
+        if(!parseHex(config.get("clone.mac"), mac, sizeof(mac)) || !radio.setAddress(mac)) {
+            RCB_LOGE("invalid clone.mac for diversity relay...\n");
+            return false;
+        }
+        if(!fs.exists(FPATH_PEER)) {
+            if(!parseHex(config.get("clone.peer"), peer.addr, sizeof(peer.addr)) ||
+                    !parseHex(config.get("clone.key"), peer.key, sizeof(peer.key))) {
+                RCB_LOGE("invalid clone.peer or clone.key for diversity relay...\n");
+                return false;
+            }
+            if(fs.write(FPATH_PEER, &peer, sizeof(peer)) != sizeof(peer)) {
+                RCB_LOGE("failed to write to <%s>...\n", FPATH_PEER);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    virtual void onSent(uint8_t* /*addr*/, uint8_t status) {
+        LogDefer defer;
         if(!matched) {
             if(status == 0) {
                 // 发送的搜索回复被接收，配对成功
                 matched = true;
             }
+            else {
+                reply_failed = true;
+            }
         }
-        else {
+        // 遥测帧在途时又发出的跳频回复必然后回调，而跳频未完成时不发遥测帧，所以在途的遥测帧总是先回调
+        else if(telemetry_busy) {
+            telemetry_busy = false;
+            if(status != 0) {
+                ntelemetry_fail++;
+            }
+        }
+        else if(!fhss) {
             if(status == 0) {
                 // 发送的跳频回复被接收，执行跳频
-                if(wifi_set_channel(new_channel)) {
-                    debug("channel set to %d...\n", new_channel);
-                    channel_direction = new_channel - channel;
+                if(radio.setChannel(new_channel)) {
+                    RCB_LOGD("channel set to %d...\n", new_channel);
                     channel = new_channel;
                 }
                 else {
-                    debug("failed to set channel to %d...\n", new_channel);
+                    RCB_LOGW("failed to set channel to %d...\n", new_channel);
                 }
             }
+            // 回复失败（发送端多半已不在本信道）则留在原信道，由发送端重发跳频命令或恢复扫描找回；
+            // 否则new_channel一直与channel不同，遥测帧再也发不出去
+            new_channel = channel;
         }
     }
 
 protected:
-    // 用户可重载以接收数据
+    // 用户可重载以接收数据，在loop()中被调用
     virtual void onData(uint8_t len, void* data) {
-        debug("data received, len = %d, data = [", len);
-        for(uint8_t i = 0; i < len; i++) {
-            debug("%02x", ((uint8_t*)data)[i]);
+#if RCB_LOG_LEVEL >= RCB_LOG_DEBUG
+        // 先格式化成一行再一次输出，至多前32字节
+        char hex[2 * 32 + 1] = "";
+        uint8_t n = len < 32 ? len : 32;
+        for(uint8_t i = 0; i < n; i++) {
+            snprintf(hex + 2 * i, 3, "%02x", ((uint8_t*)data)[i]);
+        }
+        RCB_LOGD("data received, len = %d, data = [%s%s]...\n", len, hex, len > n ? "..." : "");
+#else
+        (void)len;
+        (void)data;
+#endif
+    }
+
+};
+
+#if RCB_HAL_ESP8266
+
+// SBUS发送端，从遥控器的教练口读入SBUS，每收到完整一帧就立即发送其23字节的有效载荷，
+// 输入到发出的延迟不超过一帧，而不取决于loop()的轮询周期
+class SBusSender: public BasicSender {
+
+protected:
+    SBusInput input;
+    // 是否压缩通道数据（配置项sbus.keyframe为关键帧间隔的帧数，0表示不压缩，两端须一致），见ChannelEncoder
+    bool compress;
+    ChannelEncoder encoder;
+
+public:
+    bool begin() {
+        if(!BasicSender::begin()) {
+            return false;
+        }
+        // 过时的通道数据没有意义，只发送最新的一帧
+        coalesce = true;
+        uint8_t keyframe = config.getInt("sbus.keyframe", 0);
+        compress = keyframe != 0;
+        encoder.begin(keyframe);
+        bool ok = input.begin([](void* arg, const uint8_t* payload) {
+            // 在系统任务中回调，同样不能阻塞
+            LogDefer defer;
+            ((SBusSender*)arg)->onSBusFrame(payload);
+        }, this);
+        if(!ok) {
+            RCB_LOGE("failed to start sbus input...\n");
+            return false;
+        }
+        RCB_LOGI("sbus sender initialized, keyframe = %d...\n", keyframe);
+        return true;
+    }
+
+protected:
+    // 发送23字节的有效载荷，开启压缩时编码为关键帧或差分帧
+    bool sendChannels(const uint8_t* payload) {
+        if(!compress) {
+            return send(SBusFrame::PAYLOAD_SIZE, payload);
+        }
+        // 合并模式下新帧会取代队列中尚未发出的帧，被取代的是关键帧时这一帧也须是关键帧，
+        // 否则接收端直到下一个关键帧都无法解码
+        if(coalesce) {
+            const auto* slot = tx_queue.front();
+            if(slot != nullptr && slot->data[sequenced ? DATA_SEQ_HEADER_SIZE : 1] & ChannelEncoder::KEYFRAME) {
+                encoder.requestKeyframe();
+            }
+        }
+        SBusFrame frame;
+        frame.decodePayload(payload);
+        uint8_t data[ChannelEncoder::MAX_SIZE];
+        return send(encoder.encode(frame, data), data);
+    }
+
+    // 用户可重载该方法以在发送前修改通道数据（比如混控），payload为23字节的有效载荷
+    virtual void onSBusFrame(const uint8_t* payload) {
+        sendChannels(payload);
+    }
+
+};
+
+// SBUS接收端，以固定周期从UART0输出SBUS，收到的数据只更新输出内容而不改变输出时刻，
+// 配置项sbus.period为输出周期（7或14，单位ms），sbus.failsafe为失控保护超时（单位ms）
+class SBusReceiver: public BasicReceiver {
+
+protected:
+    SBusOutput output;
+    // 是否解码压缩的通道数据（配置项sbus.keyframe非0），见ChannelEncoder
+    bool compress;
+    ChannelDecoder decoder;
+    // 失控保护超时的下限（ms）。SBUS的输入间隔至多14ms，超过其1.5倍才置上丢帧标志，失控保护不能早于丢帧
+    static constexpr long MIN_FAILSAFE_MS = 21;
+    // 失控保护超时（ms，配置项sbus.failsafe），以及上次解码出通道数据的时刻（ms）
+    uint32_t failsafe_ms;
+    uint32_t decode_ms;
+
+public:
+    bool begin() {
+        // 过时的通道数据没有意义，队列满时用新帧覆盖旧帧
+        rx_queue.setPolicy(rx_queue.OVERWRITE_NEWEST);
+        decoder.clear();
+        if(!BasicReceiver::begin()) {
+            return false;
+        }
+        compress = config.getInt("sbus.keyframe", 0) != 0;
+        long failsafe = config.getInt("sbus.failsafe", 500);
+        if(failsafe < MIN_FAILSAFE_MS) {
+            RCB_LOGE("invalid sbus.failsafe %ld, must be at least %ldms...\n", failsafe, MIN_FAILSAFE_MS);
+            return false;
+        }
+        failsafe_ms = failsafe;
+        decode_ms = HAL::millis();
+        // 分集接收的中继端的UART0用于有线链路，不输出SBUS
+        if(diversity == DIVERSITY_RELAY) {
+            RCB_LOGI("sbus receiver initialized as diversity relay...\n");
+            return true;
+        }
+        long period = config.getInt("sbus.period", 14);
+        if(period != 7 && period != 14) {
+            RCB_LOGE("invalid sbus.period %ld, must be 7 or 14...\n", period);
+            return false;
         }
-        debug("]...\n");
+        if(!output.begin(period, failsafe_ms, diversity == DIVERSITY_OUTPUT)) {
+            RCB_LOGE("failed to start sbus output, period = %ld...\n", period);
+            return false;
+        }
+        RCB_LOGI("sbus receiver initialized, period = %ldms, failsafe = %ums...\n", period, failsafe_ms);
+        return true;
+    }
+
+protected:
+    virtual void onData(uint8_t len, void* data) override {
+        if(compress) {
+            // 中断到进入失控保护后（包括链路中断后恢复）不再信任记住的关键帧，等下一个关键帧
+            uint32_t now = HAL::millis();
+            if(now - decode_ms >= failsafe_ms) {
+                decoder.resync();
+            }
+            // 引用的关键帧丢失时保持上一帧的输出，直到下一个关键帧
+            SBusFrame frame;
+            if(!decoder.decode((uint8_t*)data, len, frame)) {
+                return;
+            }
+            decode_ms = now;
+            uint8_t payload[SBusFrame::PAYLOAD_SIZE];
+            frame.encodePayload(payload);
+            output.update(payload);
+            return;
+        }
+        if(len != SBusFrame::PAYLOAD_SIZE) {
+            RCB_LOGW("invalid sbus payload, len = %d...\n", len);
+            return;
+        }
+        output.update((uint8_t*)data);
     }
 
 };
 
+#endif
+
 }
@@ -1,24 +1,72 @@
-#include "rc-bridge.hpp"
-
 #define IS_SENDER   0
+// 是否桥接SBUS，否则发送端每100ms发送一次"hello"作为演示
+#define USE_SBUS    1
+// 是否运行基准测试（忽略USE_SBUS），发送端以BENCH_RATE（Hz）的帧率发送BENCH_SIZE字节的数据帧，
+// 两端每BENCH_REPORT（ms）输出一次统计
+#define BENCHMARK   0
+#define BENCH_RATE  100
+#define BENCH_SIZE  23
+#define BENCH_REPORT 5000
+
+#if USE_SBUS && !BENCHMARK
+// SBUS占用了UART0，调试信息改由UART1（GPIO2）输出
+#define RCB_DEBUG_PORT Serial1
+#endif
 
+#include "rc-bridge.hpp"
+#if BENCHMARK
+#include "bench.hpp"
+#endif
+
+#if BENCHMARK
 #if IS_SENDER
+RCBridge::BenchSender role;
+#else
+RCBridge::BenchReceiver role;
+#endif
+#elif IS_SENDER
+#if USE_SBUS
+RCBridge::SBusSender role;
+#else
 RCBridge::BasicSender role;
+#endif
+#else
+#if USE_SBUS
+RCBridge::SBusReceiver role;
 #else
 RCBridge::BasicReceiver role;
 #endif
+#endif
 
 void setup() {
-    Serial.begin(115200);
-    Serial.println();
+    RCB_DEBUG_PORT.begin(115200);
+    RCB_DEBUG_PORT.println();
     if(!LittleFS.begin()) {
-        Serial.print("failed to initialize LittleFS...\n");
+        RCB_DEBUG_PORT.print("failed to initialize LittleFS...\n");
     }
     role.begin();
 }
 
 void loop() {
+#if BENCHMARK
 #if IS_SENDER
+    static unsigned long last_send = 0;
+    unsigned long now_us = micros();
+    if(now_us - last_send >= 1000000 / BENCH_RATE) {
+        role.sendBench(BENCH_SIZE);
+        last_send += 1000000 / BENCH_RATE;
+        // 落后太多时不追赶
+        if(now_us - last_send >= 1000000 / BENCH_RATE) {
+            last_send = now_us;
+        }
+    }
+#endif
+    static unsigned long last_report = 0;
+    if(millis() - last_report >= BENCH_REPORT) {
+        RCB_DEBUG_PORT.print(role.benchString());
+        last_report = millis();
+    }
+#elif IS_SENDER && !USE_SBUS
     static unsigned long last_time = 0;
     unsigned long now = micros();
     if(now - last_time >= 100000) {
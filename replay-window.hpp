@@ -0,0 +1,59 @@
+#pragma once
+
+#include "hal.hpp"
+
+namespace RCBridge {
+
+// 防重放的滑动窗口。每帧带有发送方单调递增的32位计数，接收方记住见过的最大计数top，
+// 以及[top-63, top]中哪些计数已经出现过（64位位图，第i位对应top-i）。
+// 比top大的计数总是接受并把窗口前移；落在窗口内的只接受一次，允许少量乱序；比窗口更旧的一律拒绝。
+// 每帧只有一次比较、移位和按位运算，可以放在WiFi回调中
+class ReplayWindow {
+
+public:
+    static constexpr uint32_t SIZE = 64;
+
+protected:
+    uint32_t top_counter;
+    uint64_t bitmap;
+
+public:
+    ReplayWindow() {
+        clear();
+    }
+
+    // 清空窗口，不大于floor的计数都将被拒绝
+    void clear(uint32_t floor = 0) {
+        top_counter = floor;
+        // 窗口内的计数都不大于floor，全部标记为已出现
+        bitmap = ~0ull;
+    }
+
+    // 计数为counter的帧是否不是重放，是则记下该计数
+    bool check(uint32_t counter) {
+        if(counter > top_counter) {
+            uint32_t shift = counter - top_counter;
+            bitmap = shift >= SIZE ? 1 : (bitmap << shift) | 1;
+            top_counter = counter;
+            return true;
+        }
+        uint32_t diff = top_counter - counter;
+        if(diff >= SIZE) {
+            return false;
+        }
+        uint64_t mask = (uint64_t)1 << diff;
+        if(bitmap & mask) {
+            return false;
+        }
+        bitmap |= mask;
+        return true;
+    }
+
+    // 见过的最大计数
+    uint32_t top() const {
+        return top_counter;
+    }
+
+};
+
+}
@@ -0,0 +1,381 @@
+#pragma once
+
+#include "hal.hpp"
+
+namespace RCBridge {
+
+// SBUS帧，100000波特率、8E2、反相电平，每帧25字节，格式：
+// {HEADER, <22字节，16个11位通道，小端、低位在前紧密排列>, <1字节标志>, FOOTER}
+struct SBusFrame {
+
+    // 整帧字节数
+    static constexpr uint8_t SIZE = 25;
+    // 帧头、帧尾
+    static constexpr uint8_t HEADER = 0x0f;
+    static constexpr uint8_t FOOTER = 0x00;
+    // 模拟通道数，以及打包后占用的字节数
+    static constexpr uint8_t NUM_CHANNELS = 16;
+    static constexpr uint8_t CHANNEL_BYTES = 22;
+    // 去掉帧头、帧尾后的有效载荷（通道+标志），无线传输时只需传这部分
+    static constexpr uint8_t PAYLOAD_SIZE = CHANNEL_BYTES + 1;
+    // 标志字节中各位的含义
+    static constexpr uint8_t FLAG_CH17 = 0x01;
+    static constexpr uint8_t FLAG_CH18 = 0x02;
+    static constexpr uint8_t FLAG_FRAME_LOST = 0x04;
+    static constexpr uint8_t FLAG_FAILSAFE = 0x08;
+    // 通道值的常用范围（对应988us~2012us）
+    static constexpr uint16_t CHANNEL_MIN = 172;
+    static constexpr uint16_t CHANNEL_CENTER = 992;
+    static constexpr uint16_t CHANNEL_MAX = 1811;
+
+    // 16个11位模拟通道
+    uint16_t channels[NUM_CHANNELS];
+    // 标志字节，见FLAG_XXX
+    uint8_t flags;
+
+    // 通道全部置中，标志清零
+    void reset() {
+        for(uint8_t i = 0; i < NUM_CHANNELS; i++) {
+            channels[i] = CHANNEL_CENTER;
+        }
+        flags = 0;
+    }
+
+    bool flag(uint8_t mask) const {
+        return (flags & mask) != 0;
+    }
+
+    void setFlag(uint8_t mask, bool value) {
+        // 无分支地置位或清零
+        flags = (flags & ~mask) | (mask & -(uint8_t)value);
+    }
+
+    // 编码为25字节的SBUS帧
+    void encode(uint8_t* frame) const {
+        frame[0] = HEADER;
+        encodePayload(frame + 1);
+        frame[SIZE - 1] = FOOTER;
+    }
+
+    // 从25字节的SBUS帧解码，帧头或帧尾不对则返回false且不修改自身
+    bool decode(const uint8_t* frame) {
+        if(frame[0] != HEADER || frame[SIZE - 1] != FOOTER) {
+            return false;
+        }
+        decodePayload(frame + 1);
+        return true;
+    }
+
+    // 编码为23字节的有效载荷
+    void encodePayload(uint8_t* payload) const {
+        pack(channels, payload);
+        payload[CHANNEL_BYTES] = flags;
+    }
+
+    // 从23字节的有效载荷解码
+    void decodePayload(const uint8_t* payload) {
+        unpack(payload, channels);
+        flags = payload[CHANNEL_BYTES];
+    }
+
+    // 将16个通道打包为22字节。每8个通道恰好占11字节，所以分两组以固定的移位/掩码完成，
+    // 无查表、无分支、无循环，执行时间恒定，可在中断中调用
+    static void IRAM_ATTR pack(const uint16_t* channels, uint8_t* bytes) {
+        pack8(channels, bytes);
+        pack8(channels + 8, bytes + 11);
+    }
+
+    // 将22字节解包为16个通道，同pack()，执行时间恒定
+    static void IRAM_ATTR unpack(const uint8_t* bytes, uint16_t* channels) {
+        unpack8(bytes, channels);
+        unpack8(bytes + 11, channels + 8);
+    }
+
+private:
+    static inline __attribute__((always_inline)) void pack8(const uint16_t* c, uint8_t* b) {
+        // 超出11位的部分直接截掉
+        uint32_t c0 = c[0] & 0x07ff, c1 = c[1] & 0x07ff, c2 = c[2] & 0x07ff, c3 = c[3] & 0x07ff;
+        uint32_t c4 = c[4] & 0x07ff, c5 = c[5] & 0x07ff, c6 = c[6] & 0x07ff, c7 = c[7] & 0x07ff;
+        b[0] = (uint8_t)c0;
+        b[1] = (uint8_t)(c0 >> 8 | c1 << 3);
+        b[2] = (uint8_t)(c1 >> 5 | c2 << 6);
+        b[3] = (uint8_t)(c2 >> 2);
+        b[4] = (uint8_t)(c2 >> 10 | c3 << 1);
+        b[5] = (uint8_t)(c3 >> 7 | c4 << 4);
+        b[6] = (uint8_t)(c4 >> 4 | c5 << 7);
+        b[7] = (uint8_t)(c5 >> 1);
+        b[8] = (uint8_t)(c5 >> 9 | c6 << 2);
+        b[9] = (uint8_t)(c6 >> 6 | c7 << 5);
+        b[10] = (uint8_t)(c7 >> 3);
+    }
+
+    static inline __attribute__((always_inline)) void unpack8(const uint8_t* b, uint16_t* c) {
+        uint32_t b0 = b[0], b1 = b[1], b2 = b[2], b3 = b[3], b4 = b[4], b5 = b[5];
+        uint32_t b6 = b[6], b7 = b[7], b8 = b[8], b9 = b[9], b10 = b[10];
+        c[0] = (uint16_t)((b0 | b1 << 8) & 0x07ff);
+        c[1] = (uint16_t)((b1 >> 3 | b2 << 5) & 0x07ff);
+        c[2] = (uint16_t)((b2 >> 6 | b3 << 2 | b4 << 10) & 0x07ff);
+        c[3] = (uint16_t)((b4 >> 1 | b5 << 7) & 0x07ff);
+        c[4] = (uint16_t)((b5 >> 4 | b6 << 4) & 0x07ff);
+        c[5] = (uint16_t)((b6 >> 7 | b7 << 1 | b8 << 9) & 0x07ff);
+        c[6] = (uint16_t)((b8 >> 2 | b9 << 6) & 0x07ff);
+        c[7] = (uint16_t)((b9 >> 5 | b10 << 3) & 0x07ff);
+    }
+
+};
+
+// 以下为直接操作UART和定时器的输入输出，只能在ESP8266上使用
+#if RCB_HAL_ESP8266
+
+// 通过UART0的接收中断读取反相的100000波特率8E2 SBUS（如遥控器的教练口），
+// 以帧间空闲和帧头/帧尾判定帧边界，收到完整一帧后立即投递到系统任务中回调
+class SBusInput {
+
+public:
+    // 收到完整一帧时的回调，参数为23字节的有效载荷（去掉了帧头、帧尾）
+    typedef void (*Callback)(void* arg, const uint8_t* payload);
+
+protected:
+    // 帧间空闲判定阈值（UART接收超时），单位为一个字节的传输时间（约120us），
+    // SBUS帧内字节紧密相连，帧间空闲至少3ms，取2足以区分
+    static constexpr uint8_t GAP_THRESHOLD = 2;
+    // 接收FIFO的满阈值，正常情况下一帧只有25字节，不会触发，只在持续的乱码中
+    // 及时取走数据以免FIFO（128字节）溢出
+    static constexpr uint8_t FIFO_THRESHOLD = 100;
+    // 投递回调所用的系统任务优先级（Arduino的loop()使用的是USER_TASK_PRIO_1）
+    static constexpr uint8_t TASK_PRIO = USER_TASK_PRIO_2;
+
+protected:
+    Callback callback;
+    void* callback_arg;
+    // 自上次帧间空闲以来收到的字节，即当前这一段连续数据
+    uint8_t burst[SBusFrame::SIZE];
+    // 当前这一段连续数据的长度（可能超过SBusFrame::SIZE，超出的部分不保存）
+    volatile uint16_t burst_len;
+    // 当前这一段连续数据中是否出现过校验错误、帧错误或溢出
+    volatile bool burst_corrupted;
+    // 两个槽位轮流存放已完整接收的帧的有效载荷，latest指向最新的一个
+    uint8_t payloads[2][SBusFrame::PAYLOAD_SIZE];
+    volatile uint8_t latest;
+    // 是否已投递任务但尚未处理，避免任务队列被塞满
+    volatile bool posted;
+
+public:
+    // 统计：完整帧数、错误帧数（长度、帧头帧尾或校验不对）、回调来不及处理而被覆盖的帧数
+    volatile uint32_t nframe;
+    volatile uint32_t nerror;
+    volatile uint32_t noverwrite;
+
+public:
+    bool begin(Callback callback, void* arg) {
+        this->callback = callback;
+        callback_arg = arg;
+        burst_len = 0;
+        burst_corrupted = false;
+        latest = 0;
+        posted = false;
+        nframe = 0;
+        nerror = 0;
+        noverwrite = 0;
+        static os_event_t queue[1];
+        if(!system_os_task(onTask, TASK_PRIO, queue, 1)) {
+            return false;
+        }
+        // 由core配置波特率、校验位、停止位以及反相，而后用自己的中断处理函数接管UART0的接收中断
+        Serial.begin(100000, SERIAL_8E2, SERIAL_RX_ONLY, 1, true);
+        ETS_UART_INTR_DISABLE();
+        ETS_UART_INTR_ATTACH(onInterrupt, this);
+        USC1(0) = (1 << UCTOE) | (GAP_THRESHOLD << UCTOT) | (FIFO_THRESHOLD << UCFFT);
+        USIC(0) = 0xffff;
+        USIE(0) = (1 << UITO) | (1 << UIFF) | (1 << UIOF) | (1 << UIPE) | (1 << UIFR);
+        ETS_UART_INTR_ENABLE();
+        return true;
+    }
+
+protected:
+    static void IRAM_ATTR onInterrupt(void* arg, void* frame) {
+        SBusInput* self = (SBusInput*)arg;
+        uint32_t status = USIS(0);
+        if(status & ((1 << UIOF) | (1 << UIPE) | (1 << UIFR))) {
+            self->burst_corrupted = true;
+        }
+        // 取走FIFO中的所有字节
+        uint16_t len = self->burst_len;
+        for(uint8_t n = (USS(0) >> USRXC) & 0xff; n > 0; n--) {
+            uint8_t byte = USF(0);
+            if(len < SBusFrame::SIZE) {
+                self->burst[len] = byte;
+            }
+            len++;
+        }
+        self->burst_len = len;
+        // 接收超时说明出现了帧间空闲，这一段连续数据恰好是25字节且帧头帧尾正确才是完整的一帧
+        if(status & (1 << UITO)) {
+            if(len == SBusFrame::SIZE && !self->burst_corrupted &&
+                    self->burst[0] == SBusFrame::HEADER && self->burst[SBusFrame::SIZE - 1] == SBusFrame::FOOTER) {
+                self->onFrame();
+            }
+            else {
+                self->nerror++;
+            }
+            self->burst_len = 0;
+            self->burst_corrupted = false;
+        }
+        USIC(0) = status;
+    }
+
+    void IRAM_ATTR onFrame() {
+        uint8_t slot = latest ^ 1;
+        memcpy(payloads[slot], burst + 1, SBusFrame::PAYLOAD_SIZE);
+        latest = slot;
+        nframe++;
+        if(posted) {
+            noverwrite++;
+        }
+        else {
+            posted = true;
+            system_os_post(TASK_PRIO, 0, (os_param_t)this);
+        }
+    }
+
+    static void onTask(os_event_t* event) {
+        SBusInput* self = (SBusInput*)event->par;
+        uint8_t payload[SBusFrame::PAYLOAD_SIZE];
+        // 拷贝期间关中断，以免被新帧改写
+        ETS_UART_INTR_DISABLE();
+        memcpy(payload, self->payloads[self->latest], sizeof(payload));
+        self->posted = false;
+        ETS_UART_INTR_ENABLE();
+        self->callback(self->callback_arg, payload);
+    }
+
+};
+
+// 由硬件定时器timer1以固定周期（7ms或14ms）从UART0发出反相的100000波特率8E2 SBUS（如接飞控），
+// 发送时刻与无线数据到达的时刻完全解耦；没有新数据时重复最近一帧并置上丢帧标志，
+// 超时仍无新数据则置上失控保护标志。注意timer1同时被analogWrite()/Servo/tone()使用，二者不可共存
+class SBusOutput {
+
+protected:
+    // timer1以80MHz/16=5MHz计数
+    static constexpr uint32_t TICKS_PER_MS = 5000;
+    // UART的发送FIFO大小
+    static constexpr uint8_t TX_FIFO_SIZE = 128;
+
+protected:
+    // timer1的回调函数不带参数，只能通过静态变量找到实例
+    static inline SBusOutput* instance = nullptr;
+
+protected:
+    // 两个槽位轮流存放最新的有效载荷，latest指向最新的一个，定时器中断只读latest指向的槽位
+    uint8_t payloads[2][SBusFrame::PAYLOAD_SIZE];
+    volatile uint8_t latest;
+    // 自上次更新以来发出的帧数
+    volatile uint32_t nsince_update;
+    // 上次更新的时刻（us），以及平滑后的输入间隔（us，0表示尚不知道）。
+    // 输入比输出慢时（如9ms输入、7ms输出），没有新数据的输出帧并不意味着丢了输入帧，
+    // 只有距上次更新超过输入间隔的1.5倍（容许无线的抖动）才置上丢帧标志
+    volatile uint32_t update_us;
+    volatile uint32_t input_period_us;
+    // 连续多少帧未更新则进入失控保护
+    uint32_t failsafe_frames;
+
+public:
+    // 统计：发出的帧数、因发送FIFO未空而跳过的帧数、处于失控保护状态的帧数
+    volatile uint32_t nframe;
+    volatile uint32_t nskip;
+    volatile uint32_t nfailsafe;
+
+public:
+    // period_ms为输出周期（7或14），failsafe_ms为失控保护超时，
+    // rx表示同时开启UART0的接收（与SBUS同一设置），供分集接收的有线链路使用
+    bool begin(uint8_t period_ms, uint32_t failsafe_ms, bool rx = false) {
+        if(period_ms != 7 && period_ms != 14) {
+            return false;
+        }
+        // 上电后尚无数据，一开始就处于失控保护状态
+        SBusFrame frame;
+        frame.reset();
+        frame.encodePayload(payloads[0]);
+        latest = 0;
+        failsafe_frames = (failsafe_ms + period_ms - 1) / period_ms;
+        nsince_update = failsafe_frames;
+        update_us = ::micros();
+        input_period_us = 0;
+        nframe = 0;
+        nskip = 0;
+        nfailsafe = 0;
+        instance = this;
+        Serial.begin(100000, SERIAL_8E2, rx ? SERIAL_FULL : SERIAL_TX_ONLY, 1, true);
+        timer1_isr_init();
+        timer1_attachInterrupt(onTimer);
+        timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+        timer1_write(period_ms * TICKS_PER_MS);
+        return true;
+    }
+
+    void end() {
+        timer1_disable();
+        timer1_detachInterrupt();
+        instance = nullptr;
+    }
+
+    // 更新要输出的通道数据，payload为23字节的有效载荷，下一个周期生效
+    void update(const uint8_t* payload) {
+        // 写入定时器中断不会读的那个槽位，再切换，中断里就永远读不到写了一半的数据
+        uint8_t slot = latest ^ 1;
+        memcpy(payloads[slot], payload, SBusFrame::PAYLOAD_SIZE);
+        latest = slot;
+        uint32_t now = ::micros();
+        // 失控保护中的长间隔不是输入间隔；较短的间隔立即采用，较长的（丢帧或输入变慢）缓慢计入，
+        // 以免一次丢帧后把输入间隔估计得过长而掩盖之后的丢帧
+        if(nsince_update < failsafe_frames) {
+            uint32_t interval = now - update_us;
+            if(input_period_us == 0 || interval < input_period_us) {
+                input_period_us = interval;
+            }
+            else {
+                input_period_us += (interval - input_period_us) / 16;
+            }
+        }
+        update_us = now;
+        nsince_update = 0;
+    }
+
+protected:
+    static void IRAM_ATTR onTimer() {
+        SBusOutput* self = instance;
+        uint32_t nsince = self->nsince_update;
+        // 一帧25字节不超过FIFO大小，直接写入FIFO即可，无需等待
+        if(((USS(0) >> USTXC) & 0xff) > TX_FIFO_SIZE - SBusFrame::SIZE) {
+            self->nskip++;
+        }
+        else {
+            const uint8_t* payload = self->payloads[self->latest];
+            uint8_t flags = payload[SBusFrame::CHANNEL_BYTES];
+            uint32_t period = self->input_period_us;
+            if(nsince > 0 && (period == 0 || ::micros() - self->update_us > period + period / 2)) {
+                flags |= SBusFrame::FLAG_FRAME_LOST;
+            }
+            if(nsince >= self->failsafe_frames) {
+                flags |= SBusFrame::FLAG_FAILSAFE;
+                self->nfailsafe++;
+            }
+            USF(0) = SBusFrame::HEADER;
+            for(uint8_t i = 0; i < SBusFrame::CHANNEL_BYTES; i++) {
+                USF(0) = payload[i];
+            }
+            USF(0) = flags;
+            USF(0) = SBusFrame::FOOTER;
+            self->nframe++;
+        }
+        if(nsince < self->failsafe_frames) {
+            self->nsince_update = nsince + 1;
+        }
+    }
+
+};
+
+#endif
+
+}